@@ -0,0 +1,73 @@
+/*
+ * Benchmark of the matrix-vector products of the conjugate gradient, for each storage format of the matrix
+ *
+ * A synthetic circuit is generated: cells are numbered in placement order, most nets connect 2 or 3 close cells and a few are much bigger,
+ * so that the degree distribution is as skewed as on real benchmarks.
+ * Usage: coloquinte_bench_spmv [cell count] [product count]
+ */
+
+#include "coloquinte/circuit.hxx"
+
+#include <iostream>
+#include <vector>
+#include <random>
+#include <cstdlib>
+#include <cmath>
+
+using namespace coloquinte::gp;
+using namespace coloquinte;
+
+void generate_circuit(netlist & circuit, placement_t & pl, index_t cell_cnt){
+    std::mt19937 gen(1);
+    std::vector<temporary_cell> cells(cell_cnt);
+    std::vector<point<int_t> > positions(cell_cnt);
+    int_t row_len = static_cast<int_t>(std::sqrt(static_cast<double>(cell_cnt))) + 1;
+    for(index_t i=0; i<cell_cnt; ++i){
+        // A few fixed cells for the IOs
+        mask_t attributes = (i % 100 == 0) ? 0 : XMovable|YMovable|XFlippable|YFlippable;
+        cells[i] = temporary_cell(point<int_t>(10 + gen() % 30, 12), attributes, i);
+        positions[i] = point<int_t>(40 * (i % row_len), 12 * (i / row_len));
+    }
+
+    std::vector<temporary_net> nets(cell_cnt);
+    std::vector<temporary_pin> pins;
+    for(index_t n=0; n<cell_cnt; ++n){
+        nets[n] = temporary_net(n, 1);
+        index_t pin_cnt = gen() % 20 == 0 ? 4 + gen() % 60 : 2 + gen() % 2;
+        index_t center = gen() % cell_cnt;
+        for(index_t p=0; p<pin_cnt; ++p){
+            index_t c = (center + gen() % (4 * row_len)) % cell_cnt;
+            pins.push_back(temporary_pin(point<int_t>(gen() % 10, gen() % 12), c, n));
+        }
+    }
+    circuit = netlist(cells, nets, pins);
+    pl.positions_ = positions;
+    pl.orientations_ = std::vector<point<bool> >(cell_cnt, point<bool>(true, true));
+}
+
+void report(char const * model, linear_system L, index_t product_cnt){
+    char const * names[] = {"CSR", "Delta CSR", "Symmetric", "SELL", "Automatic"};
+    MatrixFormat formats[] = {CSRFormat, DeltaCSRFormat, SymmetricFormat, SELLFormat, AutomaticFormat};
+    for(MatrixFormat F : formats){
+        product_benchmark B = L.benchmark_products(F, product_cnt);
+        std::cout << model << "\t" << names[F];
+        if(F == AutomaticFormat) std::cout << " (" << names[B.format] << ")";
+        std::cout << "\t" << B.seconds * 1e3 << " ms\t" << B.gflops << " GFLOP/s\t" << B.bandwidth << " GB/s" << std::endl;
+    }
+}
+
+int main(int argc, char ** argv){
+    index_t cell_cnt = argc > 1 ? std::atoi(argv[1]) : 1000000;
+    index_t product_cnt = argc > 2 ? std::atoi(argv[2]) : 50;
+
+    netlist circuit;
+    placement_t pl;
+    generate_circuit(circuit, pl, cell_cnt);
+
+    auto HPWLF = get_HPWLF_linear_system(circuit, pl, 1.0, 2, 100000) + get_pulling_forces(circuit, pl, 1000000.0);
+    report("HPWLF", HPWLF.x_, product_cnt);
+    auto star = get_star_linear_system(circuit, pl, 1.0, 0, 100000) + get_pulling_forces(circuit, pl, 1000000.0);
+    report("Star", star.x_, product_cnt);
+    auto hybrid = get_hybrid_linear_system(circuit, pl, 1.0, net_model_policy(StarModel).add_threshold(4, CliqueModel));
+    report("Hybrid", hybrid.x_, product_cnt);
+}
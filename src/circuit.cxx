@@ -2,6 +2,10 @@
 #include "coloquinte/circuit_helper.hxx"
 #include "coloquinte/circuit.hxx"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 namespace coloquinte{
 
 std::int64_t get_HPWL_length(netlist const & circuit, placement_t const & pl, index_t net_ind){
@@ -54,10 +58,35 @@ void add_force(pin_1D const p1, pin_1D const p2, linear_system & L, float_t tol,
     add_force(p1, p2, L, scale/std::max(tol, static_cast<float_t>(std::abs(p2.pos-p1.pos))));
 }
 
+namespace{
+// Build the contributions of the nets (or cells) in parallel by ranges, and append them in order: the system is the same as after a serial build
+template<typename add_fun>
+void add_by_ranges(index_t cnt, point<linear_system> & L, add_fun add){
+    index_t const range_size = 256, batch_size = 256;
+    index_t internal_size = L.x_.internal_size();
+    index_t range_cnt = (cnt + range_size - 1) / range_size;
+    // Ranges are processed by batches to limit the memory used by the buffers
+    for(index_t batch_begin=0; batch_begin < range_cnt; batch_begin += batch_size){
+        index_t batch_end = std::min(range_cnt, batch_begin + batch_size);
+        std::vector<point<linear_system> > buffers(batch_end - batch_begin, point<linear_system>(linear_system::buffer(internal_size), linear_system::buffer(internal_size)));
+        #pragma omp parallel for schedule(dynamic)
+        for(index_t r=batch_begin; r<batch_end; ++r){
+            for(index_t i=r*range_size; i<std::min(cnt, (r+1)*range_size); ++i){
+                add(i, buffers[r-batch_begin]);
+            }
+        }
+        for(auto const & B : buffers){
+            L.x_.append_buffer(B.x_);
+            L.y_.append_buffer(B.y_);
+        }
+    }
+}
+} // End anonymous namespace
+
 point<linear_system> empty_linear_systems(netlist const & circuit, placement_t const & pl){
     point<linear_system> ret = point<linear_system>(linear_system(circuit.cell_cnt()), linear_system(circuit.cell_cnt()));
 
-    for(index_t i=0; i<circuit.cell_cnt(); ++i){
+    add_by_ranges(circuit.cell_cnt(), ret, [&](index_t i, point<linear_system> & B){
         bool found_true_net=false;
         for(auto p : circuit.get_cell(i)){
             if(circuit.get_net(p.net_ind).pin_cnt > 1){
@@ -67,14 +96,14 @@ point<linear_system> empty_linear_systems(netlist const & circuit, placement_t c
         }
 
         if( (XMovable & circuit.get_cell(i).attributes) == 0 or not found_true_net){
-            ret.x_.add_triplet(i, i, 1.0f);
-            ret.x_.add_doublet(i, pl.positions_[i].x_);
+            B.x_.add_triplet(i, i, 1.0f);
+            B.x_.add_doublet(i, pl.positions_[i].x_);
         }
         if( (YMovable & circuit.get_cell(i).attributes) == 0 or not found_true_net){
-            ret.y_.add_triplet(i, i, 1.0f);
-            ret.y_.add_doublet(i, pl.positions_[i].y_);
+            B.y_.add_triplet(i, i, 1.0f);
+            B.y_.add_doublet(i, pl.positions_[i].y_);
         }
-    }
+    });
 
     return ret;
 }
@@ -97,6 +126,94 @@ void get_HPWLF(std::vector<pin_1D> const & pins, linear_system & L, float_t tol)
     }
 }
 
+// Update in place the values stamped by get_HPWLF, if the bound pins are still the same; returns false if they changed
+bool update_HPWLF(std::vector<pin_1D> const & pins, index_t lower, index_t upper, matrix_triplet * triplets, matrix_doublet * doublets, float_t tol){
+    if(pins.size() < 2) return true;
+    auto min_elt = std::min_element(pins.begin(), pins.end()), max_elt = std::max_element(pins.begin(), pins.end());
+    if(static_cast<index_t>(min_elt - pins.begin()) != lower or static_cast<index_t>(max_elt - pins.begin()) != upper) return false;
+    float_t scale = 1.0f/(pins.size()-1);
+
+    // Same values and order as add_force
+    auto set_force = [&](pin_1D const p1, pin_1D const p2){
+        float_t force = scale/std::max(tol, static_cast<float_t>(std::abs(p2.pos-p1.pos)));
+        float_t offs1 = p1.offs, offs2 = p2.offs;
+        if(p1.movable && p2.movable){
+            triplets[0].val_ = force;
+            triplets[1].val_ = force;
+            triplets[2].val_ = -force;
+            triplets[3].val_ = -force;
+            doublets[0].val_ = force * (offs2-offs1);
+            doublets[1].val_ = force * (offs1-offs2);
+            triplets += 4;
+            doublets += 2;
+        }
+        else if(p1.movable){
+            triplets->val_ = force;
+            doublets->val_ = force * (static_cast<float_t>(p2.pos)-offs1);
+            ++triplets;
+            ++doublets;
+        }
+        else if(p2.movable){
+            triplets->val_ = force;
+            doublets->val_ = force * (static_cast<float_t>(p1.pos)-offs2);
+            ++triplets;
+            ++doublets;
+        }
+    };
+
+    for(auto it = pins.begin(); it != pins.end(); ++it){
+        if(it != min_elt){
+            set_force(*it, *min_elt);
+            if(it != max_elt){
+                set_force(*it, *max_elt);
+            }
+        }
+    }
+    return true;
+}
+
+// Same forces as get_HPWLF, with the connections between movable pins kept as a per-net stencil
+void get_HPWLF(std::vector<pin_1D> const & pins, bound_to_bound_system & L, float_t tol){
+    if(pins.size() < 2) return;
+    auto min_elt = std::min_element(pins.begin(), pins.end()), max_elt = std::max_element(pins.begin(), pins.end());
+    float_t scale = 1.0f/(pins.size()-1);
+
+    auto get_force = [&](pin_1D const p1, pin_1D const p2){
+        return scale/std::max(tol, static_cast<float_t>(std::abs(p2.pos-p1.pos)));
+    };
+    // The diagonal and the target are the same as for the assembled system
+    auto add_fixed_part = [&](pin_1D const p1, pin_1D const p2, float_t force){
+        float_t offs1 = p1.offs, offs2 = p2.offs;
+        if(p1.movable){
+            L.add_diagonal(p1.cell_ind, force);
+            L.add_doublet(p1.cell_ind, p2.movable ? force * (offs2-offs1) : force * (static_cast<float_t>(p2.pos)-offs1));
+        }
+        if(p2.movable){
+            L.add_diagonal(p2.cell_ind, force);
+            L.add_doublet(p2.cell_ind, p1.movable ? force * (offs1-offs2) : force * (static_cast<float_t>(p1.pos)-offs2));
+        }
+    };
+
+    index_t lower = min_elt->movable ? min_elt->cell_ind : bound_to_bound_system::fixed_bound();
+    index_t upper = max_elt->movable ? max_elt->cell_ind : bound_to_bound_system::fixed_bound();
+    float_t bound_force = 0.0;
+    if(max_elt != min_elt){
+        bound_force = get_force(*max_elt, *min_elt);
+        add_fixed_part(*max_elt, *min_elt, bound_force);
+    }
+    L.add_net(lower, upper, min_elt->movable and max_elt->movable ? bound_force : 0.0f);
+
+    for(auto it = pins.begin(); it != pins.end(); ++it){
+        if(it == min_elt or it == max_elt) continue;
+        float_t lower_force = get_force(*it, *min_elt), upper_force = get_force(*it, *max_elt);
+        add_fixed_part(*it, *min_elt, lower_force);
+        add_fixed_part(*it, *max_elt, upper_force);
+        if(it->movable){
+            L.add_pin(it->cell_ind, min_elt->movable ? lower_force : 0.0f, max_elt->movable ? upper_force : 0.0f);
+        }
+    }
+}
+
 void get_HPWLR(std::vector<pin_1D> const & pins, linear_system & L, float_t tol){
     std::vector<pin_1D> sorted_pins = pins;
     std::sort(sorted_pins.begin(), sorted_pins.end());
@@ -133,10 +250,51 @@ void get_clique(std::vector<pin_1D> const & pins, linear_system & L, float_t tol
     }
 }
 
+void get_MST(std::vector<pin_2D> const & pins, point<linear_system> & L, float_t tol){
+    std::vector<point<int_t> > points;
+    for(pin_2D const p : pins){
+        points.push_back(p.pos);
+    }
+    auto const edges = get_MST_topology(points);
+    for(auto E : edges){
+        add_force(pins[E.first].x(), pins[E.second].x(), L.x_, tol, 1.0f);
+        add_force(pins[E.first].y(), pins[E.second].y(), L.y_, tol, 1.0f);
+    }
+}
+
+void get_RSMT(std::vector<pin_2D> const & pins, point<linear_system> & L, float_t tol){
+    std::vector<point<int_t> > points;
+    for(pin_2D const p : pins){
+        points.push_back(p.pos);
+    }
+    auto const edges = get_RSMT_topology(points, 8);
+    for(auto E : edges.x_){
+        add_force(pins[E.first].x(), pins[E.second].x(), L.x_, tol, 1.0f);
+    }
+    for(auto E : edges.y_){
+        add_force(pins[E.first].y(), pins[E.second].y(), L.y_, tol, 1.0f);
+    }
+}
+
 } // End anonymous namespace
 
 point<linear_system> get_HPWLF_linear_system (netlist const & circuit, placement_t const & pl, float_t tol, index_t min_s, index_t max_s){
     point<linear_system> L = empty_linear_systems(circuit, pl);
+    add_by_ranges(circuit.net_cnt(), L, [&](index_t i, point<linear_system> & B){
+        // Has the net the right pin count?
+        index_t pin_cnt = circuit.get_net(i).pin_cnt;
+        if(pin_cnt < min_s or pin_cnt >= max_s) return;
+
+        auto pins = get_pins_1D(circuit, pl, i);
+        get_HPWLF(pins.x_, B.x_, tol);
+        get_HPWLF(pins.y_, B.y_, tol);
+    });
+    return L;
+}
+
+point<bound_to_bound_system> get_HPWLF_matrix_free_system (netlist const & circuit, placement_t const & pl, float_t tol, index_t min_s, index_t max_s){
+    point<bound_to_bound_system> L(bound_to_bound_system(circuit.cell_cnt()), bound_to_bound_system(circuit.cell_cnt()));
+    L += empty_linear_systems(circuit, pl);
     for(index_t i=0; i<circuit.net_cnt(); ++i){
         // Has the net the right pin count?
         index_t pin_cnt = circuit.get_net(i).pin_cnt;
@@ -149,17 +307,152 @@ point<linear_system> get_HPWLF_linear_system (netlist const & circuit, placement
     return L;
 }
 
+incremental_HPWLF_builder::incremental_HPWLF_builder(index_t min_s, index_t max_s) :
+    min_s_(min_s), max_s_(max_s),
+    stamps_(linear_system::buffer(0), linear_system::buffer(0)),
+    restamped_cnt_(0){}
+
+void incremental_HPWLF_builder::restamp(netlist const & circuit, placement_t const & pl, float_t tol, bool in_x, std::vector<char> const & changed){
+    std::vector<index_t> & lower_pins = in_x ? lower_pins_.x_ : lower_pins_.y_, & upper_pins = in_x ? upper_pins_.x_ : upper_pins_.y_;
+    std::vector<index_t> & triplet_limits = in_x ? triplet_limits_.x_ : triplet_limits_.y_, & doublet_limits = in_x ? doublet_limits_.x_ : doublet_limits_.y_;
+    linear_system & old_stamps = in_x ? stamps_.x_ : stamps_.y_;
+    index_t net_cnt = circuit.net_cnt();
+
+    std::vector<index_t> changed_nets;
+    for(index_t i=0; i<net_cnt; ++i){
+        if(changed[i]) changed_nets.push_back(i);
+    }
+    restamped_cnt_ += changed_nets.size();
+
+    // The changed nets are stamped again in parallel, by ranges, in buffers that record the limits of each net
+    index_t const range_size = 256;
+    index_t range_cnt = (changed_nets.size() + range_size - 1) / range_size;
+    std::vector<linear_system> buffers(range_cnt, linear_system::buffer(circuit.cell_cnt()));
+    // Beginning and size of the contributions of each changed net in its buffer
+    std::vector<index_t> stamped_triplets(changed_nets.size()), stamped_doublets(changed_nets.size()), stamped_triplet_cnts(changed_nets.size()), stamped_doublet_cnts(changed_nets.size());
+    bool same_sizes = true;
+    #pragma omp parallel for schedule(dynamic) reduction(&&:same_sizes)
+    for(index_t r=0; r<range_cnt; ++r){
+        linear_system & B = buffers[r];
+        for(index_t k=r*range_size; k<std::min<index_t>(changed_nets.size(), (r+1)*range_size); ++k){
+            index_t i = changed_nets[k];
+            auto pins = get_pins_1D(circuit, pl, i);
+            std::vector<pin_1D> const & dim_pins = in_x ? pins.x_ : pins.y_;
+            index_t triplet_begin = B.matrix_.size(), doublet_begin = B.recorded_target_.size();
+            get_HPWLF(dim_pins, B, tol);
+            lower_pins[i] = std::min_element(dim_pins.begin(), dim_pins.end()) - dim_pins.begin();
+            upper_pins[i] = std::max_element(dim_pins.begin(), dim_pins.end()) - dim_pins.begin();
+            stamped_triplets[k] = triplet_begin;
+            stamped_doublets[k] = doublet_begin;
+            stamped_triplet_cnts[k] = B.matrix_.size() - triplet_begin;
+            stamped_doublet_cnts[k] = B.recorded_target_.size() - doublet_begin;
+            same_sizes = same_sizes
+                and stamped_triplet_cnts[k] == triplet_limits[i+1] - triplet_limits[i]
+                and stamped_doublet_cnts[k] == doublet_limits[i+1] - doublet_limits[i];
+        }
+    }
+
+    // Copy the contributions of the k-th changed net to a position of the stamps
+    auto const copy_changed = [&](index_t k, linear_system & stamps, index_t triplet_pos, index_t doublet_pos){
+        linear_system const & B = buffers[k / range_size];
+        std::copy(B.matrix_.begin() + stamped_triplets[k], B.matrix_.begin() + stamped_triplets[k] + stamped_triplet_cnts[k], stamps.matrix_.begin() + triplet_pos);
+        std::copy(B.recorded_target_.begin() + stamped_doublets[k], B.recorded_target_.begin() + stamped_doublets[k] + stamped_doublet_cnts[k], stamps.recorded_target_.begin() + doublet_pos);
+    };
+
+    if(same_sizes){
+        // The usual case: the contributions are overwritten in place
+        #pragma omp parallel for
+        for(index_t k=0; k<changed_nets.size(); ++k){
+            index_t i = changed_nets[k];
+            copy_changed(k, old_stamps, triplet_limits[i], doublet_limits[i]);
+        }
+        return;
+    }
+
+    // Otherwise the stamps are compacted: the nets are moved in parallel to their new positions
+    std::vector<index_t> triplet_cnts(net_cnt+1, 0), doublet_cnts(net_cnt+1, 0);
+    #pragma omp parallel for
+    for(index_t i=0; i<net_cnt; ++i){
+        triplet_cnts[i+1] = triplet_limits[i+1] - triplet_limits[i];
+        doublet_cnts[i+1] = doublet_limits[i+1] - doublet_limits[i];
+    }
+    #pragma omp parallel for
+    for(index_t k=0; k<changed_nets.size(); ++k){
+        triplet_cnts[changed_nets[k]+1] = stamped_triplet_cnts[k];
+        doublet_cnts[changed_nets[k]+1] = stamped_doublet_cnts[k];
+    }
+    std::partial_sum(triplet_cnts.begin(), triplet_cnts.end(), triplet_cnts.begin());
+    std::partial_sum(doublet_cnts.begin(), doublet_cnts.end(), doublet_cnts.begin());
+
+    linear_system new_stamps = linear_system::buffer(circuit.cell_cnt());
+    new_stamps.matrix_.resize(triplet_cnts.back());
+    new_stamps.recorded_target_.resize(doublet_cnts.back());
+    #pragma omp parallel for schedule(dynamic, 256)
+    for(index_t i=0; i<net_cnt; ++i){
+        if(changed[i]) continue;
+        std::copy(old_stamps.matrix_.begin() + triplet_limits[i], old_stamps.matrix_.begin() + triplet_limits[i+1], new_stamps.matrix_.begin() + triplet_cnts[i]);
+        std::copy(old_stamps.recorded_target_.begin() + doublet_limits[i], old_stamps.recorded_target_.begin() + doublet_limits[i+1], new_stamps.recorded_target_.begin() + doublet_cnts[i]);
+    }
+    #pragma omp parallel for
+    for(index_t k=0; k<changed_nets.size(); ++k){
+        index_t i = changed_nets[k];
+        copy_changed(k, new_stamps, triplet_cnts[i], doublet_cnts[i]);
+    }
+    old_stamps = std::move(new_stamps);
+    triplet_limits = std::move(triplet_cnts);
+    doublet_limits = std::move(doublet_cnts);
+}
+
+point<linear_system> incremental_HPWLF_builder::get_linear_system(netlist const & circuit, placement_t const & pl, float_t tol){
+    index_t net_cnt = circuit.net_cnt();
+    if(lower_pins_.x_.size() != net_cnt or stamps_.x_.internal_size() != circuit.cell_cnt()){
+        // First build for this circuit: every net will be stamped
+        std::vector<index_t> no_pins(net_cnt, std::numeric_limits<index_t>::max()), no_limits(net_cnt+1, 0);
+        lower_pins_ = point<std::vector<index_t> >(no_pins, no_pins);
+        upper_pins_ = point<std::vector<index_t> >(no_pins, no_pins);
+        triplet_limits_ = point<std::vector<index_t> >(no_limits, no_limits);
+        doublet_limits_ = point<std::vector<index_t> >(no_limits, no_limits);
+        stamps_ = point<linear_system>(linear_system::buffer(circuit.cell_cnt()), linear_system::buffer(circuit.cell_cnt()));
+    }
+
+    // The nets are updated in parallel: they write disjoint ranges of the stamps
+    point<std::vector<char> > changed(std::vector<char>(net_cnt, 0), std::vector<char>(net_cnt, 0));
+    #pragma omp parallel for schedule(dynamic, 256)
+    for(index_t i=0; i<net_cnt; ++i){
+        // Has the net the right pin count?
+        index_t pin_cnt = circuit.get_net(i).pin_cnt;
+        if(pin_cnt < min_s_ or pin_cnt >= max_s_) continue;
+
+        auto pins = get_pins_1D(circuit, pl, i);
+        changed.x_[i] = not update_HPWLF(pins.x_, lower_pins_.x_[i], upper_pins_.x_[i], stamps_.x_.matrix_.data() + triplet_limits_.x_[i], stamps_.x_.recorded_target_.data() + doublet_limits_.x_[i], tol);
+        changed.y_[i] = not update_HPWLF(pins.y_, lower_pins_.y_[i], upper_pins_.y_[i], stamps_.y_.matrix_.data() + triplet_limits_.y_[i], stamps_.y_.recorded_target_.data() + doublet_limits_.y_[i], tol);
+    }
+
+    restamped_cnt_ = 0;
+    if(std::find(changed.x_.begin(), changed.x_.end(), 1) != changed.x_.end()){
+        restamp(circuit, pl, tol, true, changed.x_);
+    }
+    if(std::find(changed.y_.begin(), changed.y_.end(), 1) != changed.y_.end()){
+        restamp(circuit, pl, tol, false, changed.y_);
+    }
+
+    point<linear_system> L = empty_linear_systems(circuit, pl);
+    L.x_.append_buffer(stamps_.x_);
+    L.y_.append_buffer(stamps_.y_);
+    return L;
+}
+
 point<linear_system> get_HPWLR_linear_system (netlist const & circuit, placement_t const & pl, float_t tol, index_t min_s, index_t max_s){
     point<linear_system> L = empty_linear_systems(circuit, pl);
-    for(index_t i=0; i<circuit.net_cnt(); ++i){
+    add_by_ranges(circuit.net_cnt(), L, [&](index_t i, point<linear_system> & B){
         // Has the net the right pin count?
         index_t pin_cnt = circuit.get_net(i).pin_cnt;
-        if(pin_cnt < min_s or pin_cnt >= max_s) continue;
+        if(pin_cnt < min_s or pin_cnt >= max_s) return;
 
         auto pins = get_pins_1D(circuit, pl, i);
-        get_HPWLR(pins.x_, L.x_, tol);
-        get_HPWLR(pins.y_, L.y_, tol);
-    }
+        get_HPWLR(pins.x_, B.x_, tol);
+        get_HPWLR(pins.y_, B.y_, tol);
+    });
     return L;
 }
 
@@ -167,83 +460,123 @@ point<linear_system> get_star_linear_system  (netlist const & circuit, placement
     point<linear_system> L = empty_linear_systems(circuit, pl);
     L.x_.add_variables(circuit.net_cnt());
     L.y_.add_variables(circuit.net_cnt());
-    for(index_t i=0; i<circuit.net_cnt(); ++i){
+    add_by_ranges(circuit.net_cnt(), L, [&](index_t i, point<linear_system> & B){
         // Has the net the right pin count?
         index_t pin_cnt = circuit.get_net(i).pin_cnt;
         if(pin_cnt < min_s or pin_cnt >= max_s){
             // Put a one in the intermediate variable in order to avoid non-invertible matrices
-            L.x_.add_triplet(i+circuit.cell_cnt(), i+circuit.cell_cnt(), 1.0f);
-            L.y_.add_triplet(i+circuit.cell_cnt(), i+circuit.cell_cnt(), 1.0f);
-            continue;
+            B.x_.add_triplet(i+circuit.cell_cnt(), i+circuit.cell_cnt(), 1.0f);
+            B.y_.add_triplet(i+circuit.cell_cnt(), i+circuit.cell_cnt(), 1.0f);
+            return;
         }
 
         auto pins = get_pins_1D(circuit, pl, i);
         // Provide the index of the star's central pin in the linear system
-        get_star(pins.x_, L.x_, tol, i+circuit.cell_cnt());
-        get_star(pins.y_, L.y_, tol, i+circuit.cell_cnt());
-    }
+        get_star(pins.x_, B.x_, tol, i+circuit.cell_cnt());
+        get_star(pins.y_, B.y_, tol, i+circuit.cell_cnt());
+    });
     return L;
 }
 
 point<linear_system> get_clique_linear_system (netlist const & circuit, placement_t const & pl, float_t tol, index_t min_s, index_t max_s){
     point<linear_system> L = empty_linear_systems(circuit, pl);
-    for(index_t i=0; i<circuit.net_cnt(); ++i){
+    add_by_ranges(circuit.net_cnt(), L, [&](index_t i, point<linear_system> & B){
         // Has the net the right pin count?
         index_t pin_cnt = circuit.get_net(i).pin_cnt;
-        if(pin_cnt < min_s or pin_cnt >= max_s) continue;
+        if(pin_cnt < min_s or pin_cnt >= max_s) return;
 
         auto pins = get_pins_1D(circuit, pl, i);
-        get_clique(pins.x_, L.x_, tol);
-        get_clique(pins.y_, L.y_, tol);
-    }
+        get_clique(pins.x_, B.x_, tol);
+        get_clique(pins.y_, B.y_, tol);
+    });
     return L;
 }
 
 point<linear_system> get_MST_linear_system(netlist const & circuit, placement_t const & pl, float_t tol, index_t min_s, index_t max_s){
     point<linear_system> L = empty_linear_systems(circuit, pl);
-    for(index_t i=0; i<circuit.net_cnt(); ++i){
+    add_by_ranges(circuit.net_cnt(), L, [&](index_t i, point<linear_system> & B){
         // Has the net the right pin count?
         index_t pin_cnt = circuit.get_net(i).pin_cnt;
-        if(pin_cnt < min_s or pin_cnt >= max_s or pin_cnt <= 1) continue;
+        if(pin_cnt < min_s or pin_cnt >= max_s or pin_cnt <= 1) return;
             
-        auto pins = get_pins_2D(circuit, pl, i);
-        std::vector<point<int_t> > points;
-        for(pin_2D const p : pins){
-            points.push_back(p.pos);
-        }
-        auto const edges = get_MST_topology(points);
-        for(auto E : edges){
-            add_force(pins[E.first].x(), pins[E.second].x(), L.x_, tol, 1.0f);
-            add_force(pins[E.first].y(), pins[E.second].y(), L.y_, tol, 1.0f);
-        }
-    }
+        get_MST(get_pins_2D(circuit, pl, i), B, tol);
+    });
     return L;
 }
 
 point<linear_system> get_RSMT_linear_system(netlist const & circuit, placement_t const & pl, float_t tol, index_t min_s, index_t max_s){
     point<linear_system> L = empty_linear_systems(circuit, pl);
-    for(index_t i=0; i<circuit.net_cnt(); ++i){
+    add_by_ranges(circuit.net_cnt(), L, [&](index_t i, point<linear_system> & B){
         // Has the net the right pin count?
         index_t pin_cnt = circuit.get_net(i).pin_cnt;
-        if(pin_cnt < min_s or pin_cnt >= max_s or pin_cnt <= 1) continue;
+        if(pin_cnt < min_s or pin_cnt >= max_s or pin_cnt <= 1) return;
             
-        auto pins = get_pins_2D(circuit, pl, i);
-        std::vector<point<int_t> > points;
-        for(pin_2D const p : pins){
-            points.push_back(p.pos);
+        get_RSMT(get_pins_2D(circuit, pl, i), B, tol);
+    });
+    return L;
+}
+
+point<linear_system> get_hybrid_linear_system(netlist const & circuit, placement_t const & pl, float_t tol, net_model_policy const & policy){
+    // Get the model of each pin count once
+    index_t max_pin_cnt = 0;
+    for(index_t i=0; i<circuit.net_cnt(); ++i){
+        max_pin_cnt = std::max(max_pin_cnt, circuit.get_net(i).pin_cnt);
+    }
+    std::vector<NetModel> models(max_pin_cnt+1);
+    for(index_t s=0; s<=max_pin_cnt; ++s){
+        models[s] = policy.get(s);
+    }
+
+    // Only the nets using the star model get an additional variable
+    point<linear_system> L = empty_linear_systems(circuit, pl);
+    std::vector<index_t> star_indexes(circuit.net_cnt());
+    index_t star_index = circuit.cell_cnt();
+    for(index_t i=0; i<circuit.net_cnt(); ++i){
+        index_t pin_cnt = circuit.get_net(i).pin_cnt;
+        star_indexes[i] = star_index;
+        if(pin_cnt > 1 and models[pin_cnt] == StarModel) ++star_index;
+    }
+    L.x_.add_variables(star_index - circuit.cell_cnt());
+    L.y_.add_variables(star_index - circuit.cell_cnt());
+
+    add_by_ranges(circuit.net_cnt(), L, [&](index_t i, point<linear_system> & B){
+        index_t pin_cnt = circuit.get_net(i).pin_cnt;
+        if(pin_cnt <= 1) return;
+
+        NetModel model = models[pin_cnt];
+        if(model == MSTModel){
+            get_MST(get_pins_2D(circuit, pl, i), B, tol);
         }
-        auto const edges = get_RSMT_topology(points, 8);
-        for(auto E : edges.x_){
-            add_force(pins[E.first].x(), pins[E.second].x(), L.x_, tol, 1.0f);
+        else if(model == RSMTModel){
+            get_RSMT(get_pins_2D(circuit, pl, i), B, tol);
         }
-        for(auto E : edges.y_){
-            add_force(pins[E.first].y(), pins[E.second].y(), L.y_, tol, 1.0f);
+        else{
+            auto pins = get_pins_1D(circuit, pl, i);
+            switch(model){
+                case HPWLFModel:
+                    get_HPWLF(pins.x_, B.x_, tol);
+                    get_HPWLF(pins.y_, B.y_, tol);
+                    break;
+                case HPWLRModel:
+                    get_HPWLR(pins.x_, B.x_, tol);
+                    get_HPWLR(pins.y_, B.y_, tol);
+                    break;
+                case StarModel:
+                    get_star(pins.x_, B.x_, tol, star_indexes[i]);
+                    get_star(pins.y_, B.y_, tol, star_indexes[i]);
+                    break;
+                case CliqueModel:
+                    get_clique(pins.x_, B.x_, tol);
+                    get_clique(pins.y_, B.y_, tol);
+                    break;
+                default:
+                    assert(false);
+            }
         }
-    }
+    });
     return L;
 }
 
-
 std::int64_t get_HPWL_wirelength(netlist const & circuit, placement_t const & pl){
     std::int64_t sum = 0;
     for(index_t i=0; i<circuit.net_cnt(); ++i){
@@ -274,24 +607,19 @@ std::int64_t get_RSMT_wirelength(netlist const & circuit, placement_t const & pl
     return sum;
 }
 
-void solve_linear_system(netlist const & circuit, placement_t & pl, point<linear_system> & L, index_t nbr_iter){
-    std::vector<float_t> x_sol, y_sol;
-    std::vector<float_t> x_guess(pl.cell_cnt()), y_guess(pl.cell_cnt());
-    
-    assert(L.x_.internal_size() == x_guess.size());
-    assert(L.y_.internal_size() == y_guess.size());
-
+namespace{
+// The current positions, as the starting point of the solvers
+void get_position_guess(placement_t const & pl, std::vector<float_t> & x_guess, std::vector<float_t> & y_guess){
+    x_guess.resize(pl.cell_cnt());
+    y_guess.resize(pl.cell_cnt());
     for(index_t i=0; i<pl.cell_cnt(); ++i){
         x_guess[i] = static_cast<float_t>(pl.positions_[i].x_);
         y_guess[i] = static_cast<float_t>(pl.positions_[i].y_);
     }
-    #pragma omp parallel sections num_threads(2)
-    {
-    #pragma omp section
-    x_sol = L.x_.solve_CG(x_guess, nbr_iter);
-    #pragma omp section
-    y_sol = L.y_.solve_CG(y_guess, nbr_iter);
-    }
+}
+
+// Move the movable cells to the solution
+void update_positions(netlist const & circuit, placement_t & pl, std::vector<float_t> const & x_sol, std::vector<float_t> const & y_sol){
     for(index_t i=0; i<pl.cell_cnt(); ++i){
         if( (circuit.get_cell(i).attributes & XMovable) != 0){
             assert(std::isfinite(x_sol[i]));
@@ -304,6 +632,121 @@ void solve_linear_system(netlist const & circuit, placement_t & pl, point<linear
     }
 }
 
+template<typename solve_fun>
+void solve_and_update(netlist const & circuit, placement_t & pl, solve_fun solve){
+    std::vector<float_t> x_sol, y_sol, x_guess, y_guess;
+    get_position_guess(pl, x_guess, y_guess);
+    solve(x_guess, y_guess, x_sol, y_sol);
+    update_positions(circuit, pl, x_sol, y_sol);
+}
+
+// Solve the x and y systems, sharing the threads as requested
+template<typename x_fun, typename y_fun>
+void solve_dimensions(DimensionParallelism parallelism, x_fun solve_x, y_fun solve_y){
+    if(parallelism == SequentialDimensions){
+        solve_x();
+        solve_y();
+        return;
+    }
+#ifdef _OPENMP
+    int inner_threads = 1;
+    int max_levels = omp_get_max_active_levels();
+    if(parallelism == NestedDimensions){
+        inner_threads = std::max(1, omp_get_max_threads() / 2);
+        omp_set_max_active_levels(std::max(max_levels, 2));
+    }
+#endif
+    #pragma omp parallel sections num_threads(2)
+    {
+    #pragma omp section
+    {
+#ifdef _OPENMP
+    omp_set_num_threads(inner_threads);
+#endif
+    solve_x();
+    }
+    #pragma omp section
+    {
+#ifdef _OPENMP
+    omp_set_num_threads(inner_threads);
+#endif
+    solve_y();
+    }
+    }
+#ifdef _OPENMP
+    omp_set_max_active_levels(max_levels);
+#endif
+}
+} // End anonymous namespace
+
+point<solver_report> solve_linear_system(netlist const & circuit, placement_t & pl, point<linear_system> & L, index_t nbr_iter, solver_options const & options){
+    assert(L.x_.internal_size() == pl.cell_cnt());
+    assert(L.y_.internal_size() == pl.cell_cnt());
+    if(options.block_dimensions){
+        point<solver_workspace> workspaces;
+        return solve_linear_system(circuit, pl, L, nbr_iter, workspaces, options);
+    }
+    point<solver_report> reports;
+    solve_and_update(circuit, pl, [&](std::vector<float_t> const & x_guess, std::vector<float_t> const & y_guess, std::vector<float_t> & x_sol, std::vector<float_t> & y_sol){
+        solve_dimensions(options.dimension_parallelism,
+            [&](){ x_sol = L.x_.solve_CG(x_guess, nbr_iter, options, &reports.x_); },
+            [&](){ y_sol = L.y_.solve_CG(y_guess, nbr_iter, options, &reports.y_); }
+        );
+    });
+    return reports;
+}
+
+point<solver_report> solve_linear_system(netlist const & circuit, placement_t & pl, point<linear_system> & L, index_t nbr_iter, point<symbolic_matrix> & structures, solver_options const & options){
+    assert(L.x_.internal_size() == pl.cell_cnt());
+    assert(L.y_.internal_size() == pl.cell_cnt());
+    if(options.block_dimensions){
+        // Lend the structures to temporary workspaces
+        point<solver_workspace> workspaces;
+        workspaces.x_.structure = std::move(structures.x_);
+        workspaces.y_.structure = std::move(structures.y_);
+        point<solver_report> reports = solve_linear_system(circuit, pl, L, nbr_iter, workspaces, options);
+        structures.x_ = std::move(workspaces.x_.structure);
+        structures.y_ = std::move(workspaces.y_.structure);
+        return reports;
+    }
+    point<solver_report> reports;
+    solve_and_update(circuit, pl, [&](std::vector<float_t> const & x_guess, std::vector<float_t> const & y_guess, std::vector<float_t> & x_sol, std::vector<float_t> & y_sol){
+        solve_dimensions(options.dimension_parallelism,
+            [&](){ x_sol = L.x_.solve_CG(x_guess, nbr_iter, structures.x_, options, &reports.x_); },
+            [&](){ y_sol = L.y_.solve_CG(y_guess, nbr_iter, structures.y_, options, &reports.y_); }
+        );
+    });
+    return reports;
+}
+
+point<solver_report> solve_linear_system(netlist const & circuit, placement_t & pl, point<linear_system> & L, index_t nbr_iter, point<solver_workspace> & workspaces, solver_options const & options){
+    assert(L.x_.internal_size() == pl.cell_cnt());
+    assert(L.y_.internal_size() == pl.cell_cnt());
+    point<solver_report> reports;
+    get_position_guess(pl, workspaces.x_.guess, workspaces.y_.guess);
+    if(not options.block_dimensions or not linear_system::solve_block_CG(L, nbr_iter, workspaces, options, reports)){
+        solve_dimensions(options.dimension_parallelism,
+            [&](){ L.x_.solve_CG(workspaces.x_.guess, nbr_iter, workspaces.x_, options, &reports.x_); },
+            [&](){ L.y_.solve_CG(workspaces.y_.guess, nbr_iter, workspaces.y_, options, &reports.y_); }
+        );
+    }
+    update_positions(circuit, pl, workspaces.x_.solution, workspaces.y_.solution);
+    return reports;
+}
+
+point<solver_report> solve_linear_system(netlist const & circuit, placement_t & pl, point<bound_to_bound_system> const & L, index_t nbr_iter, solver_options const & options){
+    assert(L.x_.size() == pl.cell_cnt());
+    assert(L.y_.size() == pl.cell_cnt());
+    point<solver_report> reports;
+    solve_and_update(circuit, pl, [&](std::vector<float_t> const & x_guess, std::vector<float_t> const & y_guess, std::vector<float_t> & x_sol, std::vector<float_t> & y_sol){
+        solve_dimensions(options.dimension_parallelism,
+            [&](){ x_sol = L.x_.solve_CG(x_guess, nbr_iter, options, &reports.x_); },
+            [&](){ y_sol = L.y_.solve_CG(y_guess, nbr_iter, options, &reports.y_); }
+        );
+    });
+    return reports;
+}
+
 // Intended to be used by pulling forces to adapt the forces to the cell's areas
 std::vector<float_t> get_area_scales(netlist const & circuit){
     std::vector<float_t> ret(circuit.cell_cnt());
@@ -324,16 +767,16 @@ point<linear_system> get_pulling_forces (netlist const & circuit, placement_t co
     point<linear_system> L = empty_linear_systems(circuit, pl);
     float_t typical_force = 1.0f / typical_distance;
     std::vector<float_t> scaling = get_area_scales(circuit);
-    for(index_t i=0; i<pl.cell_cnt(); ++i){
-        L.x_.add_anchor(
+    add_by_ranges(pl.cell_cnt(), L, [&](index_t i, point<linear_system> & B){
+        B.x_.add_anchor(
             typical_force * scaling[i],
             i, pl.positions_[i].x_
         );
-        L.y_.add_anchor(
+        B.y_.add_anchor(
             typical_force * scaling[i],
             i, pl.positions_[i].y_
         );
-    }
+    });
     
     return L;
 }
@@ -342,16 +785,16 @@ point<linear_system> get_linear_pulling_forces (netlist const & circuit, placeme
     point<linear_system> L = empty_linear_systems(circuit, UB_pl);
     assert(LB_pl.cell_cnt() == UB_pl.cell_cnt());
     std::vector<float_t> scaling = get_area_scales(circuit);
-    for(index_t i=0; i<LB_pl.cell_cnt(); ++i){
-        L.x_.add_anchor(
+    add_by_ranges(LB_pl.cell_cnt(), L, [&](index_t i, point<linear_system> & B){
+        B.x_.add_anchor(
             force * scaling[i] / (std::max(static_cast<float_t>(std::abs(UB_pl.positions_[i].x_ - LB_pl.positions_[i].x_)), min_distance)),
             i, UB_pl.positions_[i].x_
         );
-        L.y_.add_anchor(
+        B.y_.add_anchor(
             force * scaling[i] / (std::max(static_cast<float_t>(std::abs(UB_pl.positions_[i].y_ - LB_pl.positions_[i].y_)), min_distance)),
             i, UB_pl.positions_[i].y_
         );
-    }
+    });
     
 
     return L;
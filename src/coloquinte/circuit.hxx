@@ -18,6 +18,36 @@ namespace gp{
 
 point<linear_system> empty_linear_systems(netlist const & circuit, placement_t const & pl);
 
+enum NetModel{
+    HPWLFModel,
+    HPWLRModel,
+    StarModel,
+    CliqueModel,
+    MSTModel,
+    RSMTModel
+};
+
+// The net model to use depending on the pin count
+struct net_model_policy{
+    // Nets with a pin count below a threshold use its model; the thresholds are sorted in increasing order
+    std::vector<std::pair<index_t, NetModel> > thresholds_;
+    // Model for the nets above all thresholds
+    NetModel default_model_;
+
+    net_model_policy(NetModel default_model) : default_model_(default_model){}
+    net_model_policy & add_threshold(index_t max_s, NetModel model){
+        assert(thresholds_.empty() or thresholds_.back().first < max_s);
+        thresholds_.push_back(std::pair<index_t, NetModel>(max_s, model));
+        return *this;
+    }
+    NetModel get(index_t pin_cnt) const{
+        for(auto const & T : thresholds_){
+            if(pin_cnt < T.first) return T.second;
+        }
+        return default_model_;
+    }
+};
+
 // Net models stuff
 point<linear_system> get_HPWLF_linear_system  (netlist const & circuit, placement_t const & pl, float_t tol, index_t min_s, index_t max_s);
 point<linear_system> get_HPWLR_linear_system  (netlist const & circuit, placement_t const & pl, float_t tol, index_t min_s, index_t max_s);
@@ -26,12 +56,49 @@ point<linear_system> get_clique_linear_system (netlist const & circuit, placemen
 point<linear_system> get_MST_linear_system    (netlist const & circuit, placement_t const & pl, float_t tol, index_t min_s, index_t max_s);
 point<linear_system> get_RSMT_linear_system   (netlist const & circuit, placement_t const & pl, float_t tol, index_t min_s, index_t max_s);
 
+// Visit each net once and use the model given by its pin count, instead of summing systems built for different pin count ranges
+point<linear_system> get_hybrid_linear_system (netlist const & circuit, placement_t const & pl, float_t tol, net_model_policy const & policy);
+
+// Same model as get_HPWLF_linear_system, but the matrix is applied net by net instead of being assembled; pulling forces can be added to it
+point<bound_to_bound_system> get_HPWLF_matrix_free_system (netlist const & circuit, placement_t const & pl, float_t tol, index_t min_s, index_t max_s);
+
+/*
+ * Repeated builds of the HPWLF systems, for nets with a pin count in [min_s, max_s)
+ *
+ * The contributions of each net are kept between calls: the nets whose bound pins are unchanged only get the values of their forces updated in place,
+ * and the others are stamped again. The triplets keep their order, so a symbolic_matrix remains valid as long as no bound changed.
+ * The systems are the same as with get_HPWLF_linear_system.
+ */
+class incremental_HPWLF_builder{
+    index_t min_s_, max_s_;
+    // For each net, the positions of its bound pins in the net at the last build, and the ranges of its triplets and target contributions
+    point<std::vector<index_t> > lower_pins_, upper_pins_, triplet_limits_, doublet_limits_;
+    point<linear_system> stamps_;
+    index_t restamped_cnt_;
+
+    void restamp(netlist const & circuit, placement_t const & pl, float_t tol, bool in_x, std::vector<char> const & changed);
+
+    public:
+    incremental_HPWLF_builder(index_t min_s, index_t max_s);
+    point<linear_system> get_linear_system(netlist const & circuit, placement_t const & pl, float_t tol);
+    // The number of nets stamped again in x and y during the last build
+    index_t restamped_net_cnt() const{ return restamped_cnt_; }
+};
+
 // Additional forces
 point<linear_system> get_pulling_forces (netlist const & circuit, placement_t const & pl, float_t typical_distance);
 point<linear_system> get_linear_pulling_forces (netlist const & circuit, placement_t const & UB_pl, placement_t const & LB_pl, float_t force, float_t min_distance);
 
-// Solve the final linear system
-void solve_linear_system(netlist const & circuit, placement_t & pl, point<linear_system> & L, index_t nbr_iter);
+// Solve the final linear system, with at most nbr_iter iterations or until the tolerances of the options are met; returns how each dimension converged
+// The storage of the solvers is allocated again at each call
+point<solver_report> solve_linear_system(netlist const & circuit, placement_t & pl, point<linear_system> & L, index_t nbr_iter, solver_options const & options = solver_options());
+// Keep the structures of the matrices between calls: when the sparsity pattern is unchanged (star and clique models, pulling forces), only the values are recomputed
+// The other storage of the solvers is still allocated at each call
+point<solver_report> solve_linear_system(netlist const & circuit, placement_t & pl, point<linear_system> & L, index_t nbr_iter, point<symbolic_matrix> & structures, solver_options const & options = solver_options());
+// Keep all the storage of the solvers between calls: once the sizes are reached, solves with the CSR format and the Jacobi preconditioner don't allocate
+// This is the only overload whose consecutive calls don't allocate
+point<solver_report> solve_linear_system(netlist const & circuit, placement_t & pl, point<linear_system> & L, index_t nbr_iter, point<solver_workspace> & workspaces, solver_options const & options = solver_options());
+point<solver_report> solve_linear_system(netlist const & circuit, placement_t & pl, point<bound_to_bound_system> const & L, index_t nbr_iter, solver_options const & options = solver_options());
 
 // Cost-related stuff, whether wirelength or disruption
 std::int64_t get_HPWL_wirelength (netlist const & circuit, placement_t const & pl);
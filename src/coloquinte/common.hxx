@@ -4,6 +4,7 @@
 
 #include <cstdint>
 #include <algorithm>
+#include <utility>
 
 namespace coloquinte{
 
@@ -39,15 +40,17 @@ struct point{
         return point<S>(static_cast<S>(x_), static_cast<S>(y_));
     }
 
-    void operator+=(point<T> const o){
-        x_ += o.x_;
-        y_ += o.y_;
+    template<typename S>
+    void operator+=(point<S> o){
+        x_ += std::move(o.x_);
+        y_ += std::move(o.y_);
     }
 };
 
+// The arguments are taken by value and moved, so that temporaries with heavy storage (linear systems) are reused
 template<typename T>
-point<T> operator+(point<T> const a, point<T> const b){
-    return point<T>(a.x_+b.x_, a.y_+b.y_);
+point<T> operator+(point<T> a, point<T> b){
+    return point<T>(std::move(a.x_)+std::move(b.x_), std::move(a.y_)+std::move(b.y_));
 }
 template<typename T>
 point<T> operator-(point<T> const a, point<T> const b){
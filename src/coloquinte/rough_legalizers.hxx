@@ -56,6 +56,17 @@ class region_distribution{
         cell_ref(capacity_t demand, point<float_t> p, index_t ind) : allocated_capacity_(demand), pos_(p), index_in_list_(ind){}
         friend region;
     };
+
+    // A cell with the difference of its costs in two regions, computed once before sorting
+    // Ties are broken by cell, so that any sort gives the same order up to the pieces of a same cell
+    struct cost_diff_cell : cell_ref{
+        float_t marginal_cost_;
+
+        bool operator<(cost_diff_cell const & o) const{
+            return marginal_cost_ < o.marginal_cost_ or (marginal_cost_ == o.marginal_cost_ and index_in_list_ < o.index_in_list_);
+        }
+        cost_diff_cell(cell_ref cell, float_t cost) : cell_ref(cell), marginal_cost_(cost){}
+    };
     
     struct region{
         public:
@@ -64,31 +75,35 @@ class region_distribution{
         point<float_t> pos_;
     
         std::vector<cell_ref> cell_references_;
+        capacity_t allocated_capacity_; // Sum over cell_references_, updated whenever they are rewritten
 
         // Constructors
-        region(){} // Necessary if we want to resize vectors 
+        region() : allocated_capacity_(0){} // Necessary if we want to resize vectors 
         region(capacity_t cap, point<float_t> pos, std::vector<cell_ref> cells);
 
         // Helper functions for bipartitioning
+        // The costs vector is used as scratch storage and is modified
         private:
-        static void distribute_new_cells(region & a, region & b, std::vector<cell_ref> cells); // Called by the other two to do the dirty work
+        static void distribute_new_cells(region & a, region & b, std::vector<cost_diff_cell> & costs); // Called by the other two to do the dirty work; distributes the cells currently in a
         public:
-        void distribute_cells(region & a, region & b) const;    // Distribute the cells from one region to two
-        static void redistribute_cells(region & a, region & b); // Optimizes the distribution between two regions
+        void distribute_cells(region & a, region & b, std::vector<cost_diff_cell> & costs) const;    // Distribute the cells from one region to two
+        static void redistribute_cells(region & a, region & b, std::vector<cost_diff_cell> & costs); // Optimizes the distribution between two regions
 
         // Helper functions for multipartitioning
         private:
-        static void distribute_new_cells(std::vector<std::reference_wrapper<region_distribution::region> > regions, std::vector<cell_ref> cells);
+        static void distribute_new_cells(std::vector<std::reference_wrapper<region_distribution::region> > const & regions, std::vector<cell_ref> & cells);
         public:
         void distribute_cells(std::vector<std::reference_wrapper<region_distribution::region> > regions) const;
         static void redistribute_cells(std::vector<std::reference_wrapper<region_distribution::region> > regions);
 
         // Helper functions for 1D transportation
         public:
-        static void distribute_new_cells(std::vector<std::reference_wrapper<region_distribution::region> > regions, std::vector<cell_ref> cells, std::function<float_t (point<float_t>)> coord);
-        static void redistribute_cells(std::vector<std::reference_wrapper<region_distribution::region> > & regions, std::function<float_t (point<float_t>)> coord);
+        // The cells vector is used as scratch storage and is modified
+        static void distribute_new_cells(std::vector<std::reference_wrapper<region_distribution::region> > const & regions, std::vector<cell_ref> & cells, std::function<float_t (point<float_t>)> coord);
+        static void redistribute_cells(std::vector<std::reference_wrapper<region_distribution::region> > const & regions, std::vector<cell_ref> & cells, std::function<float_t (point<float_t>)> coord);
 
         public:
+        void update_allocated_capacity();
         void uniquify_references();
         void selfcheck() const;
 
@@ -108,6 +123,7 @@ class region_distribution{
     
     std::vector<movable_cell> cell_list_;
     std::vector<region> placement_regions_;
+    std::vector<region> spare_regions_; // Previous level of the hierarchy; kept so that its reference storage is reused by the next partitioning
 
     box<int_t> placement_area_;
     std::vector<density_limit> density_map_;
@@ -125,7 +141,8 @@ class region_distribution{
     static void just_uniquify(std::vector<cell_ref> & cell_references);
 
     // Prepare regions with the right positions and capacities; different levels of nesting are compatible
-    std::vector<region> prepare_regions(index_t x_cnt, index_t y_cnt) const;
+    // The regions are emptied but keep their storage
+    void prepare_regions(std::vector<region> & regions, index_t x_cnt, index_t y_cnt) const;
 
     public:
     
@@ -226,13 +243,7 @@ inline index_t region_distribution::fractional_cell_cnt() const{
 
 inline capacity_t region_distribution::region::capacity() const{ return capacity_; }
 inline capacity_t region_distribution::region::unused_capacity() const{ return capacity() - allocated_capacity(); }
-inline capacity_t region_distribution::region::allocated_capacity() const{
-    capacity_t ret = 0;
-    for(cell_ref const C : cell_references_){
-       ret += C.allocated_capacity_; 
-    }
-    return ret;
-}
+inline capacity_t region_distribution::region::allocated_capacity() const{ return allocated_capacity_; }
 inline index_t region_distribution::region::cell_cnt() const{ return cell_references_.size(); }
 
 inline float_t region_distribution::region::distance(region_distribution::cell_ref const & C) const{
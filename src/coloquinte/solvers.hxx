@@ -5,6 +5,10 @@
 #include "common.hxx"
 
 #include <vector>
+#include <cassert>
+#include <cstdint>
+#include <utility>
+#include <limits>
 
 namespace coloquinte{
 namespace gp{
@@ -20,22 +24,254 @@ struct matrix_doublet{
 struct matrix_triplet{
     index_t r_, c_;
     float_t val_;
+    matrix_triplet(){}
     matrix_triplet(index_t ri, index_t ci, float_t v) : r_(ri), c_(ci), val_(v){}
     bool operator<(matrix_triplet const o){ return r_ < o.r_ || (r_ == o.r_ && c_ < o.c_); }
 };
 
+// The classical compressed sparse row storage
+struct csr_matrix{
+    std::vector<std::uint32_t> row_limits, col_indexes;
+    std::vector<float> values, diag;
+
+    std::vector<float> mul(std::vector<float> const & x) const;
+    // In place, reusing the storage of the result
+    void mul(std::vector<float> const & x, std::vector<float> & res) const;
+    std::vector<float> solve_CG(std::vector<float> const & goal, std::vector<float> guess, std::uint32_t min_iter, std::uint32_t max_iter, float tol) const;
+    std::uint64_t storage_bytes() const;
+    csr_matrix(){}
+    csr_matrix(std::vector<std::uint32_t> const & row_l, std::vector<std::uint32_t> const & col_i, std::vector<float> const & vals, std::vector<float> const D) : row_limits(row_l), col_indexes(col_i), values(vals), diag(D){
+        assert(values.size() == col_indexes.size());
+        assert(diag.size()+1 == row_limits.size());
+    }
+};
+
+// Setup of the solvers that only depends on the sparsity pattern, kept with the structure of the matrix
+struct pattern_cache{
+    // The aggregates of each level of the multigrid preconditioner, giving the variable of the next level,
+    // and the size and number of off-diagonal elements of the matrix of the level they were computed for
+    // Their strength of connection uses the values of the first matrix: for later ones, they are an approximation that only makes the preconditioner less efficient
+    std::vector<std::vector<index_t> > amg_aggregates;
+    std::vector<std::pair<index_t, index_t> > amg_level_sizes;
+    // The bandwidth-reducing order of the variables (reorder_variables): the original index of each variable,
+    // and the reordered matrix with the original position of each off-diagonal element; its values are refilled at each solve
+    std::vector<index_t> reordering, reordered_elements;
+    csr_matrix reordered_matrix;
+    // The subdomains of the additive Schwarz preconditioner: the variables of each subdomain, starting with the schwarz_owned variables it doesn't share,
+    // and the subdomain count and overlap they were computed for
+    std::vector<index_t> schwarz_limits, schwarz_variables, schwarz_owned;
+    std::pair<index_t, index_t> schwarz_parameters;
+};
+
+/*
+ * The structure of a compressed matrix, computed once from the triplets of a system
+ *
+ * Each diagonal or off-diagonal element of the compressed matrix is a slot, which sums the values of several triplets
+ * As long as the triplets keep the same rows and columns in the same order, only the values need to be refilled:
+ * no sorting is needed anymore, and each slot can be summed independently
+ */
+class symbolic_matrix{
+    // The pattern this structure was built for
+    std::vector<index_t> triplet_rows_, triplet_cols_;
+    index_t size_;
+
+    // The compressed structure, without the diagonal
+    std::vector<std::uint32_t> row_limits_, col_indexes_;
+
+    // The triplets summed in each slot: the size_ diagonal slots first, then the off-diagonal elements
+    std::vector<index_t> slot_limits_, slot_triplets_;
+
+    pattern_cache cache_;
+
+    public:
+    symbolic_matrix() : size_(0), row_limits_(1, 0), slot_limits_(1, 0){} // Same structure as an empty system
+    symbolic_matrix(std::vector<matrix_triplet> const & triplets, index_t size);
+
+    bool matches(std::vector<matrix_triplet> const & triplets, index_t size) const;
+    index_t size() const{ return size_; }
+    index_t nonzero_cnt() const{ return col_indexes_.size(); }
+    pattern_cache & cache(){ return cache_; }
+
+    // Sum the triplets' values in the slots to obtain the compressed matrix
+    csr_matrix get_compressed_matrix(std::vector<matrix_triplet> const & triplets) const;
+    // Same, reusing the storage of a matrix
+    void get_compressed_matrix(std::vector<matrix_triplet> const & triplets, csr_matrix & mat) const;
+};
+
+// Storage of the matrix during the iterations
+enum MatrixFormat{
+    CSRFormat,      // Classical compressed sparse rows with 32-bit column indexes
+    DeltaCSRFormat, // Column indexes stored as 8 or 16-bit offsets from the row, for locality-ordered cells
+    SymmetricFormat,// Diagonal and strict upper triangle only
+    SELLFormat,     // Sliced ELLPACK with rows sorted by length (SELL-C-sigma), for vectorized products
+    AutomaticFormat // SELL if its padding is small enough, CSR otherwise
+};
+
+// Speed of the matrix-vector products of a system in a given format
+struct product_benchmark{
+    MatrixFormat format;    // The format used, once the automatic choice is made
+    double seconds;         // Mean time of a product
+    double gflops;          // Two operations for each nonzero element, padding excluded
+    double bandwidth;       // In GB/s, with the matrix storage and the vectors transferred once per product
+};
+
+// How the x and y systems share the threads
+enum DimensionParallelism{
+    SequentialDimensions, // One system after the other, each with all the threads
+    ConcurrentDimensions, // Both systems at the same time, each with a single thread
+    NestedDimensions      // Both systems at the same time, each with half the threads
+};
+
+// Preconditioner of the conjugate gradient
+enum PreconditionerType{
+    JacobiPreconditioner,               // Inverse of the diagonal
+    SSORPreconditioner,                 // Symmetric successive over-relaxation
+    IncompleteCholeskyPreconditioner,   // Incomplete Cholesky factorization without fill-in, IC(0)
+    AMGPreconditioner,                  // Aggregation-based multigrid; the aggregates are reused with a symbolic_matrix
+    SchwarzPreconditioner               // Additive Schwarz on overlapping subdomains with a coarse level, with an IC(0) factorization per subdomain; the subdomains are reused with a symbolic_matrix
+};
+
+// Iterative method
+enum SolverType{
+    CGSolver,           // Conjugate gradient, with two reductions per iteration
+    PipelinedCGSolver,  // Pipelined conjugate gradient (Ghysels-Vanroose), with a single fused reduction per iteration; falls back to the former if unstable
+    ChebyshevSolver     // Chebyshev iteration, without reductions once the eigenvalue bounds are estimated by the first iterations of the conjugate gradient
+};
+
+// Outcome of a solve
+struct solver_report{
+    index_t iterations;
+    float_t residual;           // Norm of the residual of the iterated system, as updated by the conjugate gradient
+    float_t relative_residual;  // The same relative to the norm of the target
+    double seconds;             // Including the compression of the matrix and the construction of the preconditioner
+
+    solver_report() : iterations(0), residual(0.0), relative_residual(0.0), seconds(0.0){}
+};
+
+// Options of the linear solvers
+struct solver_options{
+    // Eliminate the additional variables of the system (star model) from the iterations, using the Schur complement on the internal variables
+    bool condense_additional_variables;
+    // Solve the variables with no off-diagonal element (fixed cells, cells without nets) directly, and iterate on the others only
+    bool eliminate_decoupled_variables;
+    // Renumber the variables in reverse Cuthill-McKee order inside the solver, so that the products access the vectors almost sequentially
+    // The order is kept with the structure of the matrix; not used by the condensed system
+    bool reorder_variables;
+    MatrixFormat format;
+    DimensionParallelism dimension_parallelism;
+    // Solve the x and y systems together when they have the same sparsity pattern, so that the products share the traversal of the matrix
+    // Only with the classical conjugate gradient in single precision without deflation, the Jacobi preconditioner, without condensation or reordering: the systems are solved independently otherwise
+    bool block_dimensions;
+    // The condensed and matrix-free systems always use the classical conjugate gradient
+    SolverType solver;
+    // Deflated conjugate gradient: number of approximate eigenvectors of the smallest eigenvalues kept in the workspace, and deflated from the next solves
+    // Only with the classical conjugate gradient, in single precision; useful when the same solver_workspace is used for successive solves
+    index_t deflation_vectors;
+    // Chebyshev iteration: conjugate gradient iterations used to estimate the eigenvalues (Lanczos), and iterations between two tests of the tolerances
+    index_t chebyshev_lanczos_steps;
+    index_t chebyshev_check_period;
+    // The condensed system (condense_additional_variables) always uses the Jacobi preconditioner
+    PreconditionerType preconditioner;
+    // Relaxation factor of SSOR, in ]0, 2[
+    float_t SSOR_relaxation;
+    // Additive Schwarz: number of subdomains, independent from the number of threads so that the results are too, and layers of neighbours added to each subdomain
+    index_t schwarz_subdomains;
+    index_t schwarz_overlap;
+    // The matrix and the vectors are always stored in float; with mixed precision, the reductions and the coefficients of the classical conjugate gradient are computed in double
+    bool mixed_precision;
+    // Iterative refinement: after the first solve, the residual is computed in double and the correction is solved again, refinement_steps times at most
+    // The solution is accumulated in double; not used by the condensed system
+    index_t refinement_steps;
+
+    // Stop before the maximum iteration count once one of the tolerances is met, but not before min_iterations; null tolerances are never met
+    index_t min_iterations;
+    float_t relative_tolerance;     // Residual norm, relative to the norm of the target
+    float_t absolute_tolerance;     // Residual norm
+    float_t displacement_tolerance; // Largest change of a variable during the last iteration
+
+    solver_options() : condense_additional_variables(false), eliminate_decoupled_variables(true), reorder_variables(false), format(CSRFormat), dimension_parallelism(SequentialDimensions), block_dimensions(false), solver(CGSolver), deflation_vectors(0), chebyshev_lanczos_steps(10), chebyshev_check_period(8), preconditioner(JacobiPreconditioner), SSOR_relaxation(1.0), schwarz_subdomains(16), schwarz_overlap(1), mixed_precision(false), refinement_steps(0),
+        min_iterations(0), relative_tolerance(0.0), absolute_tolerance(0.0), displacement_tolerance(0.0){}
+};
+
+/*
+ * The storage of the solver, kept between the solves of a system
+ *
+ * The compressed matrix is refilled in place while the sparsity pattern is unchanged, and the vectors of the conjugate gradient are reused:
+ * once their sizes are reached, solves with the CSR format and the Jacobi preconditioner don't allocate.
+ * The other formats and preconditioners, and the condensation of the additional variables, still build their data at each solve.
+ */
+struct solver_workspace{
+    symbolic_matrix structure;
+    csr_matrix matrix;
+
+    // The starting point given by the caller, and the solution of the internal variables
+    std::vector<float_t> guess, solution;
+
+    // The renumbering of the variables coupled to others, and the system restricted to them (eliminate_decoupled_variables)
+    std::vector<std::uint32_t> new_indexes, old_indexes;
+    csr_matrix coupled_matrix;
+    std::vector<float> coupled_goal, coupled_solution;
+    // The target and solution in the order of the reordered matrix (reorder_variables)
+    std::vector<float> reordered_goal, reordered_solution;
+    // The deflated conjugate gradient (deflation_vectors): the approximate eigenvectors kept from the previous solves and their products,
+    // and the first directions of the current solve, from which the next ones are extracted
+    std::vector<std::vector<float> > deflation_basis, deflation_products, recycled_directions;
+    // The original index of each variable of the solver and of each element of the basis, to follow the variables when they change
+    std::vector<std::uint32_t> solver_indexes, deflation_indexes, reordered_indexes;
+
+    // The vectors of the conjugate gradient
+    std::vector<float> residual, preconditioned, direction, product, inverse_diag;
+    // The additional vectors of the pipelined conjugate gradient
+    std::vector<float> pipeline_w, pipeline_m, pipeline_z, pipeline_q, pipeline_s;
+    // The partial sums of the blocks in the reductions
+    std::vector<float> partial_sums, partial_sq_norms, partial_steps, partial_curvatures;
+    // The same in double for mixed precision, and the double precision solution and the correction of the iterative refinement
+    std::vector<double> accurate_sums, accurate_sq_norms, accurate_solution;
+    std::vector<float> correction, correction_goal;
+
+    // The interleaved target and solution of two systems solved together; their other vectors are interleaved in the workspace of the first one
+    std::vector<float> block_goal, block_solution;
+};
+
+class bound_to_bound_system;
+class incremental_HPWLF_builder;
+
 class linear_system{
+    friend class bound_to_bound_system;
+    friend class incremental_HPWLF_builder;
+
     std::vector<matrix_triplet> matrix_;
     std::vector<float_t> target_;
     index_t internal_size_;
+
+    // The additional variables of appended systems are renumbered lazily, before the compression
+    // Each element gives the first triplet of a range and the offset of its additional variables
+    std::vector<std::pair<index_t, index_t> > variable_offsets_;
+
+    // When the system is a buffer for part of a parallel build, the contributions to the target are recorded to be summed later in the same order
+    bool record_target_;
+    std::vector<matrix_doublet> recorded_target_;
+
+    void append_triplets(std::vector<matrix_triplet> const & triplets, std::vector<std::pair<index_t, index_t> > const & offsets, index_t offset);
+    void append_target(std::vector<float_t> const & target);
+    void apply_variable_offsets();
+    // Solve with the compressed matrix of the workspace; the result is its solution
+    void solve_compressed(std::vector<float_t> const & guess, index_t nbr_iter, solver_options const & options, pattern_cache * cache, solver_report & report, solver_workspace & workspace) const;
     
     public:
     void add_triplet(index_t row, index_t col, float_t val){ matrix_.push_back(matrix_triplet(row, col, val)); }
 
     linear_system operator+(linear_system const & o) const;
+    linear_system & operator+=(linear_system const & o);
+    linear_system & operator+=(linear_system && o);
 
     void add_doublet(index_t row, float_t val){
-        target_[row] += val;
+        if(record_target_){
+            recorded_target_.push_back(matrix_doublet(row, val));
+        }
+        else{
+            target_[row] += val;
+        }
     }
 
     void add_force(
@@ -70,16 +306,98 @@ class linear_system{
         add_doublet(c, scale*pos);
     }
 
-    linear_system(index_t s) : target_(s, 0.0), internal_size_(s){}
-    linear_system(index_t s, index_t i) : target_(s, 0.0), internal_size_(i){}
+    linear_system(index_t s) : target_(s, 0.0), internal_size_(s), record_target_(false){}
+    linear_system(index_t s, index_t i) : target_(s, 0.0), internal_size_(i), record_target_(false){}
+
+    // A buffer to build part of a system in parallel; the buffers appended in order give the same system as a serial build, bit for bit
+    static linear_system buffer(index_t internal_size){
+        linear_system ret(0, internal_size);
+        ret.record_target_ = true;
+        return ret;
+    }
+    void append_buffer(linear_system const & o);
 
     index_t size() const{ return target_.size(); }
     index_t internal_size() const{ return internal_size_; }
     void add_variables(index_t cnt){ target_.resize(target_.size() + cnt, 0.0); }
 
-    std::vector<float_t> solve_CG(std::vector<float_t> guess, index_t nbr_iter);
+    // At most nbr_iter iterations; the report, if given, is filled
+    std::vector<float_t> solve_CG(std::vector<float_t> guess, index_t nbr_iter, solver_options const & options = solver_options(), solver_report * report = nullptr);
+    // Reuse the structure of the matrix if the sparsity pattern didn't change since the last call
+    std::vector<float_t> solve_CG(std::vector<float_t> guess, index_t nbr_iter, symbolic_matrix & structure, solver_options const & options = solver_options(), solver_report * report = nullptr);
+    // Reuse the structure and all the storage of the solver; the result is the solution of the workspace
+    std::vector<float_t> const & solve_CG(std::vector<float_t> const & guess, index_t nbr_iter, solver_workspace & workspace, solver_options const & options = solver_options(), solver_report * report = nullptr);
+    // Solve the x and y systems together from the guesses of the workspaces, with the same results as separate solves
+    // Returns false without solving if the options or the sparsity patterns don't allow it
+    static bool solve_block_CG(point<linear_system> & L, index_t nbr_iter, point<solver_workspace> & workspaces, solver_options const & options, point<solver_report> & reports);
+
+    // Time the matrix-vector products used by the solver for a storage format
+    product_benchmark benchmark_products(MatrixFormat format, index_t product_cnt);
 };
 
+/*
+ * A matrix-free system for the bound-to-bound (HPWLF) net model
+ *
+ * The matrix is never assembled: each net stores the variables of its two bound pins and, for each other movable pin, its weights to them.
+ * The product is computed by walking the nets. Connections to fixed pins only contribute to the diagonal, which is also used by the preconditioner.
+ * It is always solved by the conjugate gradient with the Jacobi preconditioner, in storage allocated for each solve:
+ * only the stopping criteria of the solver options apply, and the choices of solver, preconditioner, format, precision and deflation are ignored.
+ */
+class bound_to_bound_system{
+    static const index_t null_ind = std::numeric_limits<index_t>::max();
+
+    // The bound pins of each net (null_ind if fixed) and the weight of the connection between them
+    std::vector<index_t> net_limits_, lower_bounds_, upper_bounds_;
+    std::vector<float_t> bound_weights_;
+
+    // The other movable pins and their weights to the lower and upper bounds
+    std::vector<index_t> pin_variables_;
+    std::vector<float_t> lower_weights_, upper_weights_;
+
+    std::vector<float_t> diag_, target_;
+
+    public:
+    bound_to_bound_system(index_t s) : net_limits_(1, 0), diag_(s, 0.0), target_(s, 0.0){}
+
+    // Start a new net; the bounds are the variables of the bound pins, or null_ind for fixed pins
+    void add_net(index_t lower, index_t upper, float_t bound_weight){
+        net_limits_.push_back(net_limits_.back());
+        lower_bounds_.push_back(lower);
+        upper_bounds_.push_back(upper);
+        bound_weights_.push_back(bound_weight);
+    }
+    // Connect a movable pin of the last net to the movable bounds
+    void add_pin(index_t var, float_t lower_weight, float_t upper_weight){
+        pin_variables_.push_back(var);
+        lower_weights_.push_back(lower_weight);
+        upper_weights_.push_back(upper_weight);
+        ++net_limits_.back();
+    }
+
+    void add_diagonal(index_t var, float_t val){ diag_[var] += val; }
+    void add_doublet(index_t var, float_t val){ target_[var] += val; }
+    void add_anchor(float_t scale, index_t var, float_t pos){
+        add_diagonal(var, scale);
+        add_doublet(var, scale*pos);
+    }
+    // Only systems with diagonal matrices, such as pulling forces, may be added
+    bound_to_bound_system & operator+=(linear_system const & o);
+
+    index_t size() const{ return target_.size(); }
+    index_t net_cnt() const{ return lower_bounds_.size(); }
+    static index_t fixed_bound(){ return null_ind; }
+
+    std::vector<float> mul(std::vector<float> const & x) const;
+    void mul(std::vector<float> const & x, std::vector<float> & res) const;
+    // Only the stopping criteria of the options are used
+    std::vector<float_t> solve_CG(std::vector<float_t> guess, index_t nbr_iter, solver_options const & options = solver_options(), solver_report * report = nullptr) const;
+};
+
+// Reuse the storage of temporary systems
+linear_system operator+(linear_system && a, linear_system const & b);
+linear_system operator+(linear_system && a, linear_system && b);
+linear_system operator+(linear_system const & a, linear_system && b);
+
 } // namespace gp
 } // namespace coloquinte
 
@@ -121,11 +121,14 @@ int main(){
     std::cout << "The simply legalized wirelength is " << get_HPWL_wirelength(circuit, UB_pl) << " at " << time(NULL) << " with linear disruption " << get_mean_linear_disruption(circuit, LB_pl, UB_pl) << " and quadratic disruption " << get_mean_quadratic_disruption(circuit, LB_pl, UB_pl) << std::endl;
     LB_pl = UB_pl;
 
+    // The storage of the solvers, kept for all the solves
+    point<solver_workspace> workspaces;
+
     // Early topology-independent solution
     auto solv = get_star_linear_system(circuit, LB_pl, 1.0, 0, 10000)
             + get_pulling_forces(circuit, UB_pl, 1000000.0); // Big distance: doesn't pull strongly, but avoids problems if there are no fixed pins
     std::cout << "Star optimization at time " << time(NULL) << std::endl;
-    solve_linear_system(circuit, LB_pl, solv, 200); // number of iterations=200
+    solve_linear_system(circuit, LB_pl, solv, 200, workspaces); // number of iterations=200
     output_report(circuit, LB_pl);
 
     coloquinte::float_t pulling_force = 0.01;
@@ -157,7 +160,7 @@ int main(){
         auto solv = get_HPWLF_linear_system(circuit, LB_pl, 0.01, 2, 100000)
             + get_linear_pulling_forces(circuit, UB_pl, LB_pl, pulling_force, 40.0);
         std::cout << "Got the linear system at time " << time(NULL) << std::endl;
-        solve_linear_system(circuit, LB_pl, solv, 400); // number of iterations
+        solve_linear_system(circuit, LB_pl, solv, 400, workspaces); // number of iterations
         output_report(circuit, LB_pl);
 
         // Optimize orientation sometimes
@@ -12,6 +12,36 @@ namespace gp{
 
 namespace{
     const capacity_t default_density_mul = 256;
+    const index_t parallel_sort_threshold = 1 << 14; // Minimum number of cells to sort a single region with several threads
+    const index_t parallel_sort_blocks = 16;
+
+    // Sort blocks in parallel, then merge them pairwise
+    // The blocks and the merges are tasks, so that they are picked up by the threads of the enclosing parallel region that are out of work
+    // The number of blocks only depends on the size, so that the order of equivalent elements does not depend on the number of threads
+    template<typename T, typename Compare>
+    void parallel_sort(std::vector<T> & elts, Compare comp){
+        if(elts.size() < parallel_sort_threshold){
+            std::sort(elts.begin(), elts.end(), comp);
+            return;
+        }
+        index_t const block_cnt = parallel_sort_blocks;
+        std::vector<index_t> limits(block_cnt+1);
+        for(index_t b=0; b<=block_cnt; ++b){
+            limits[b] = static_cast<std::uint64_t>(elts.size()) * b / block_cnt;
+        }
+        for(index_t b=0; b<block_cnt; ++b){
+            #pragma omp task shared(elts, limits, comp) firstprivate(b)
+            std::sort(elts.begin() + limits[b], elts.begin() + limits[b+1], comp);
+        }
+        #pragma omp taskwait
+        for(index_t width=1; width<block_cnt; width*=2){
+            for(index_t b=0; b<block_cnt-width; b+=2*width){
+                #pragma omp task shared(elts, limits, comp) firstprivate(b, width)
+                std::inplace_merge(elts.begin() + limits[b], elts.begin() + limits[b+width], elts.begin() + limits[std::min(b+2*width, block_cnt)], comp);
+            }
+            #pragma omp taskwait
+        }
+    }
 }
 
 void region_distribution::just_uniquify(std::vector<cell_ref> & cell_references){
@@ -38,6 +68,13 @@ void region_distribution::sort_uniquify(std::vector<cell_ref> & cell_references)
     just_uniquify(cell_references);
 }
 
+void region_distribution::region::update_allocated_capacity(){
+    allocated_capacity_ = 0;
+    for(cell_ref const c : cell_references_){
+        allocated_capacity_ += c.allocated_capacity_;
+    }
+}
+
 void region_distribution::region::uniquify_references(){
     sort_uniquify(cell_references_);
 }
@@ -58,6 +95,7 @@ void region_distribution::region::selfcheck() const{
         assert(c.allocated_capacity_ > 0);
     }
     assert(total_allocated <= capacity_);
+    assert(total_allocated == allocated_capacity_);
 }
 
 void region_distribution::selfcheck() const{
@@ -75,7 +113,9 @@ void region_distribution::selfcheck() const{
     }
 }
 
-region_distribution::region::region(capacity_t cap, point<float_t> pos, std::vector<cell_ref> cells) : capacity_(cap), pos_(pos), cell_references_(cells){}
+region_distribution::region::region(capacity_t cap, point<float_t> pos, std::vector<cell_ref> cells) : capacity_(cap), pos_(pos), cell_references_(cells){
+    update_allocated_capacity();
+}
 
 box<int_t> region_distribution::get_box(index_t x, index_t y, index_t x_cnt, index_t y_cnt) const{
     auto ret = box<int_t>(
@@ -88,7 +128,7 @@ box<int_t> region_distribution::get_box(index_t x, index_t y, index_t x_cnt, ind
     return ret;
 }
 
-std::vector<region_distribution::region> region_distribution::prepare_regions(index_t x_cnt, index_t y_cnt) const{
+void region_distribution::prepare_regions(std::vector<region> & regions, index_t x_cnt, index_t y_cnt) const{
     assert(placement_area_.x_max_ > placement_area_.x_min_);
     assert(placement_area_.y_max_ > placement_area_.y_min_);
 
@@ -277,75 +317,101 @@ std::vector<region_distribution::region> region_distribution::prepare_regions(in
         add_region(box<int_t>(it->first, std::next(it)->first, it->second.y_min_, it->second.y_max_), it->second.multiplicator_); 
     }
 
-    std::vector<region> ret(x_cnt*y_cnt);
+    // Reinitialize the regions in place: the references' storage is kept from one use to the next
+    regions.resize(x_cnt*y_cnt);
     for(index_t y=0; y<y_cnt; ++y){
         for(index_t x=0; x<x_cnt; ++x){
             box<int_t> bx = get_box(x, y, x_cnt, y_cnt);
-            ret[y*x_cnt + x] = region(
-                region_caps[y*x_cnt + x],
-                point<float_t>(0.5f * bx.x_min_ + 0.5f * bx.x_max_, 0.5f * bx.y_min_ + 0.5f * bx.y_max_),
-                std::vector<cell_ref>()
-            );
+            region & R = regions[y*x_cnt + x];
+            R.capacity_ = region_caps[y*x_cnt + x];
+            R.pos_ = point<float_t>(0.5f * bx.x_min_ + 0.5f * bx.x_max_, 0.5f * bx.y_min_ + 0.5f * bx.y_max_);
+            R.cell_references_.clear();
+            R.allocated_capacity_ = 0;
         }
     }
-    return ret;
 }
 
 void region_distribution::x_bipartition(){
-    std::vector<region> old_placement_regions = prepare_regions(2*x_regions_cnt(), y_regions_cnt());
-    placement_regions_.swap(old_placement_regions);
+    prepare_regions(spare_regions_, 2*x_regions_cnt(), y_regions_cnt());
+    placement_regions_.swap(spare_regions_);
+    std::vector<region> const & old_placement_regions = spare_regions_;
 
     index_t old_x_regions_cnt = x_regions_cnt();
     index_t old_y_regions_cnt = y_regions_cnt();
     x_regions_cnt_ *= 2;
 
-    for(index_t x=0; x < old_x_regions_cnt; ++x){
-        for(index_t y=0; y < old_y_regions_cnt; ++y){
-            index_t i = y * old_x_regions_cnt + x;
-            old_placement_regions[i].distribute_cells(get_region(2*x, y), get_region(2*x+1, y));
-        }
+    // Each parent only writes to its own two children
+    // The splits have very different sizes, hence the dynamic schedule; when there are fewer parents than threads,
+    // the threads that are out of parents sort the blocks of the large ones
+    index_t old_regions_cnt = old_x_regions_cnt * old_y_regions_cnt;
+    #pragma omp parallel
+    {
+    // Per-thread storage, reused for every parent
+    std::vector<cost_diff_cell> costs;
+    #pragma omp for schedule(dynamic)
+    for(index_t i=0; i < old_regions_cnt; ++i){
+        index_t x = i % old_x_regions_cnt, y = i / old_x_regions_cnt;
+        old_placement_regions[i].distribute_cells(get_region(2*x, y), get_region(2*x+1, y), costs);
+    }
     }
 }
 
 void region_distribution::y_bipartition(){
-    std::vector<region> old_placement_regions = prepare_regions(x_regions_cnt(), 2*y_regions_cnt());
-    placement_regions_.swap(old_placement_regions);
+    prepare_regions(spare_regions_, x_regions_cnt(), 2*y_regions_cnt());
+    placement_regions_.swap(spare_regions_);
+    std::vector<region> const & old_placement_regions = spare_regions_;
 
     index_t old_x_regions_cnt = x_regions_cnt();
     index_t old_y_regions_cnt = y_regions_cnt();
     y_regions_cnt_ *= 2;
 
-    for(index_t x=0; x < old_x_regions_cnt; ++x){
-        for(index_t y=0; y < old_y_regions_cnt; ++y){
-            index_t i = y * old_x_regions_cnt + x;
-            old_placement_regions[i].distribute_cells(get_region(x, 2*y), get_region(x, 2*y+1));
-        }
+    // Each parent only writes to its own two children
+    // The splits have very different sizes, hence the dynamic schedule; when there are fewer parents than threads,
+    // the threads that are out of parents sort the blocks of the large ones
+    index_t old_regions_cnt = old_x_regions_cnt * old_y_regions_cnt;
+    #pragma omp parallel
+    {
+    // Per-thread storage, reused for every parent
+    std::vector<cost_diff_cell> costs;
+    #pragma omp for schedule(dynamic)
+    for(index_t i=0; i < old_regions_cnt; ++i){
+        index_t x = i % old_x_regions_cnt, y = i / old_x_regions_cnt;
+        old_placement_regions[i].distribute_cells(get_region(x, 2*y), get_region(x, 2*y+1), costs);
+    }
     }
 }
 
 // The big awful function that handles optimal cell distribution between two regions; not meant to be called externally
-void region_distribution::region::distribute_new_cells(region & region_a, region & region_b, std::vector<cell_ref> basic_cells){
-    struct cost_diff_cell : cell_ref{
-        float_t marginal_cost_;
-
-        bool operator<(cost_diff_cell const o) const{ return marginal_cost_ < o.marginal_cost_; }
-        cost_diff_cell(cell_ref cell, float_t cost) : cell_ref(cell), marginal_cost_(cost) {}
-    };
-
-    std::vector<cost_diff_cell> cells;
-    for(cell_ref const c : basic_cells){
-        cells.push_back(cost_diff_cell(c, region_a.distance(c) - region_b.distance(c)));
+// The cells to distribute are those of region_a, and the result is written back in place; the costs are sorted in the caller's scratch storage
+// The sort uses several threads when the regions are large, i.e. at the top of the hierarchy
+void region_distribution::region::distribute_new_cells(region & region_a, region & region_b, std::vector<cost_diff_cell> & costs){
+    std::vector<cell_ref> & cells = region_a.cell_references_;
+    costs.clear();
+    for(cell_ref const & c : cells){
+        costs.push_back(cost_diff_cell(c, region_a.distance(c) - region_b.distance(c)));
     }
 
     // Cells trending toward a first
-    std::sort(cells.begin(), cells.end());//, [](cell_ref const c1, cell_ref const c2) -> bool{ return c1.marginal_cost_ < c2.marginal_cost_; });
+    parallel_sort(costs, [](cost_diff_cell const & c1, cost_diff_cell const & c2) -> bool{ return c1 < c2; });
+    // The pieces of a cell have the same cost and are now adjacent: merge them
+    index_t merged_cnt = 0;
+    for(index_t i=0; i<costs.size(); ++i){
+        if(merged_cnt > 0 and costs[merged_cnt-1].index_in_list_ == costs[i].index_in_list_){
+            costs[merged_cnt-1].allocated_capacity_ += costs[i].allocated_capacity_;
+        }
+        else{
+            costs[merged_cnt++] = costs[i];
+        }
+    }
+    costs.erase(costs.begin() + merged_cnt, costs.end());
+    cells.assign(costs.begin(), costs.end());
 
     index_t preference_limit=0,         // First cell that would rather go to b (or cells.size())
          a_capacity_limit=0,            // After the last cell that region_a can take entirely (or 0)
          b_capacity_limit=cells.size(); // Last cell (but first in the vector) that region_b can take entirely (or cells.size())
 
     capacity_t remaining_capacity_a = region_a.capacity_, remaining_capacity_b = region_b.capacity_;
-    for(;preference_limit < cells.size() && cells[preference_limit].marginal_cost_ <= 0.0; ++preference_limit);
+    for(;preference_limit < cells.size() && costs[preference_limit].marginal_cost_ <= 0.0; ++preference_limit);
 
     { // Block
     capacity_t remaining_cap_a = region_a.capacity_;
@@ -373,13 +439,12 @@ void region_distribution::region::distribute_new_cells(region & region_a, region
     }
     } // Block
 
-    std::vector<cell_ref> & cells_a_side = region_a.cell_references_;
+    // The cells for a are a prefix of the sorted cells and stay where they are; b takes the end
     std::vector<cell_ref> & cells_b_side = region_b.cell_references_;
-    cells_a_side.clear();
     cells_b_side.clear();
     if(preference_limit >= b_capacity_limit and preference_limit <= a_capacity_limit){
-        cells_a_side.insert(cells_a_side.end(), cells.begin(), cells.begin() + preference_limit);
         cells_b_side.insert(cells_b_side.end(), cells.begin() + preference_limit, cells.end());
+        cells.resize(preference_limit);
     }
     else{
         index_t cut_position;
@@ -396,39 +461,34 @@ void region_distribution::region::distribute_new_cells(region & region_a, region
             allocated_to_a_part = remaining_capacity_a;
         }
 
-        cells_a_side.reserve( cut_position             +1);
-        cells_b_side.reserve(cells.size()-cut_position +1);
-
-        cells_a_side.insert(cells_a_side.end(), cells.begin(), cells.begin() + cut_position);
-
         cell_ref cell_cut_a = cells[cut_position], cell_cut_b = cells[cut_position];
         cell_cut_a.allocated_capacity_ = allocated_to_a_part;
         cell_cut_b.allocated_capacity_ -= allocated_to_a_part;
-        if(cell_cut_a.allocated_capacity_ > 0){ cells_a_side.push_back(cell_cut_a); }
         if(cell_cut_b.allocated_capacity_ > 0){ cells_b_side.push_back(cell_cut_b); }
-
         cells_b_side.insert(cells_b_side.end(), cells.begin() + cut_position+1, cells.end());
+
+        cells.resize(cut_position);
+        if(cell_cut_a.allocated_capacity_ > 0){ cells.push_back(cell_cut_a); }
     }
+    region_a.update_allocated_capacity();
+    region_b.update_allocated_capacity();
 }
 
-void region_distribution::region::distribute_cells(region & a, region & b) const{
-    distribute_new_cells(a, b, cell_references_);
+void region_distribution::region::distribute_cells(region & a, region & b, std::vector<cost_diff_cell> & costs) const{
+    a.cell_references_.assign(cell_references_.begin(), cell_references_.end());
+    distribute_new_cells(a, b, costs);
     assert(a.allocated_capacity() + b.allocated_capacity() == allocated_capacity());
     assert(a.capacity() + b.capacity() == capacity());
 }
 
-void region_distribution::region::redistribute_cells(region & Ra, region & Rb){
+void region_distribution::region::redistribute_cells(region & Ra, region & Rb, std::vector<cost_diff_cell> & costs){
     if(Ra.capacity() > 0 and Rb.capacity() > 0){
-        std::vector<cell_ref> cells;
-        cells.reserve(Ra.cell_references_.size()+Rb.cell_references_.size());
-        cells.insert(cells.end(), Ra.cell_references_.begin(), Ra.cell_references_.end());
-        cells.insert(cells.end(), Rb.cell_references_.begin(), Rb.cell_references_.end());
-
-        distribute_new_cells(Ra, Rb, cells);
+        Ra.cell_references_.insert(Ra.cell_references_.end(), Rb.cell_references_.begin(), Rb.cell_references_.end());
+        distribute_new_cells(Ra, Rb, costs);
     }
 }
 
-void region_distribution::region::distribute_new_cells(std::vector<std::reference_wrapper<region_distribution::region> > regions, std::vector<cell_ref> all_cells){
+void region_distribution::region::distribute_new_cells(std::vector<std::reference_wrapper<region_distribution::region> > const & regions, std::vector<cell_ref> & all_cells){
     std::vector<capacity_t> caps;
     for(region_distribution::region & R : regions){
         caps.push_back(R.capacity_);
@@ -459,8 +519,8 @@ void region_distribution::region::distribute_new_cells(std::vector<std::referenc
                 regions[i].get().cell_references_.push_back(C);
             }
         }
+        regions[i].get().update_allocated_capacity();
     }
-
 }
 
 void region_distribution::region::redistribute_cells(std::vector<std::reference_wrapper<region_distribution::region> > regions){
@@ -474,14 +534,16 @@ void region_distribution::region::redistribute_cells(std::vector<std::reference_
 }
 
 void region_distribution::region::distribute_cells(std::vector<std::reference_wrapper<region_distribution::region> > regions) const{
-    distribute_new_cells(regions, cell_references_);
+    std::vector<cell_ref> all_cells = cell_references_;
+    distribute_new_cells(regions, all_cells);
 }
 
 void region_distribution::multipartition(index_t x_width, index_t y_width){
     assert(x_width > 0 and y_width > 0);
 
-    std::vector<region> old_placement_regions = prepare_regions(x_width*x_regions_cnt(), y_width*y_regions_cnt());
-    placement_regions_.swap(old_placement_regions);
+    prepare_regions(spare_regions_, x_width*x_regions_cnt(), y_width*y_regions_cnt());
+    placement_regions_.swap(spare_regions_);
+    std::vector<region> const & old_placement_regions = spare_regions_;
 
     index_t old_x_regions_cnt = x_regions_cnt();
     index_t old_y_regions_cnt = y_regions_cnt();
@@ -520,68 +582,78 @@ void region_distribution::redo_bipartitions(){
 
 void region_distribution::redo_diagonal_bipartitions(){
     // Take four cells at a time and optimize them
-    auto const optimize_quad_diag = [&](index_t x, index_t y){
-        region::redistribute_cells(get_region(x, y), get_region(x+1, y+1));
-        region::redistribute_cells(get_region(x+1, y), get_region(x, y+1));
+    auto const optimize_quad_diag = [&](index_t x, index_t y, std::vector<cost_diff_cell> & costs){
+        region::redistribute_cells(get_region(x, y), get_region(x+1, y+1), costs);
+        region::redistribute_cells(get_region(x+1, y), get_region(x, y+1), costs);
     };
 
     // x is the fast index: the innermost loop operates on it
-    auto const optimize_diag_on_y = [&](index_t y){
+    auto const optimize_diag_on_y = [&](index_t y, std::vector<cost_diff_cell> & costs){
         for(index_t x=0; x+1 < x_regions_cnt(); x+=2){
             if(x+2 < x_regions_cnt()){
                 // x odd
-                optimize_quad_diag(x+1, y);
+                optimize_quad_diag(x+1, y, costs);
             }
             // x even
-            optimize_quad_diag(x, y);
+            optimize_quad_diag(x, y, costs);
         }
     };
 
+    #pragma omp parallel
+    {
+    // Per-thread storage, reused for every pair of regions
+    std::vector<cost_diff_cell> costs;
     // OpenMP doesn't allow y+1 < y_regions_cnt(), but anyway y_regions_cnt() >= 1
-    #pragma omp parallel for
+    #pragma omp for
     for(index_t y=0; y < y_regions_cnt()-1; y+=2){
         // y even
-        optimize_diag_on_y(y);
+        optimize_diag_on_y(y, costs);
     }
-    #pragma omp parallel for
+    #pragma omp for
     for(index_t y=1; y < y_regions_cnt()-1; y+=2){
         // y odd
-        optimize_diag_on_y(y);
+        optimize_diag_on_y(y, costs);
+    }
     }
 }
 
 void region_distribution::redo_adjacent_bipartitions(){
-    auto const optimize_H = [&](index_t x, index_t y){
-        region::redistribute_cells(get_region(x, y), get_region(x+1, y));
+    auto const optimize_H = [&](index_t x, index_t y, std::vector<cost_diff_cell> & costs){
+        region::redistribute_cells(get_region(x, y), get_region(x+1, y), costs);
     };
-    auto const optimize_V = [&](index_t x, index_t y){
-        region::redistribute_cells(get_region(x, y), get_region(x, y+1));
+    auto const optimize_V = [&](index_t x, index_t y, std::vector<cost_diff_cell> & costs){
+        region::redistribute_cells(get_region(x, y), get_region(x, y+1), costs);
     };
 
+    #pragma omp parallel
+    {
+    // Per-thread storage, reused for every pair of regions
+    std::vector<cost_diff_cell> costs;
     // x bipartitions
-    #pragma omp parallel for
+    #pragma omp for
     for(index_t y=0; y < y_regions_cnt(); ++y){
         for(index_t x=0; x+1 < x_regions_cnt(); x+=2){
             if(x+2 < x_regions_cnt()){
                 // x odd
-                optimize_H(x+1, y);
+                optimize_H(x+1, y, costs);
             }
             // x even
-            optimize_H(x, y);
+            optimize_H(x, y, costs);
         }
     }
     // y bipartitions
-    #pragma omp parallel for
+    #pragma omp for
     for(index_t x=0; x < x_regions_cnt(); ++x){
         for(index_t y=0; y+1 < y_regions_cnt(); y+=2){
             if(y+2 < y_regions_cnt()){
                 // y odd
-                optimize_V(x, y+1);
+                optimize_V(x, y+1, costs);
             }
             // y even
-            optimize_V(x, y);
+            optimize_V(x, y, costs);
         }
     }
+    }
 }
 
 void region_distribution::redo_multipartitions(index_t x_width, index_t y_width){
@@ -614,7 +686,7 @@ void region_distribution::redo_multipartitions(index_t x_width, index_t y_width)
     }
 }
 
-inline void region_distribution::region::distribute_new_cells(std::vector<std::reference_wrapper<region> > regions, std::vector<cell_ref> cells, std::function<float_t (point<float_t>)> coord){
+inline void region_distribution::region::distribute_new_cells(std::vector<std::reference_wrapper<region> > const & regions, std::vector<cell_ref> & cells, std::function<float_t (point<float_t>)> coord){
 	// Gather all cells and the useful regions
 	std::vector<std::reference_wrapper<region> > all_regions;
 
@@ -679,10 +751,13 @@ inline void region_distribution::region::distribute_new_cells(std::vector<std::r
 			cur_cap -= used_cap;
 		}
 	}
+	for(region & reg_ref : all_regions){
+		reg_ref.update_allocated_capacity();
+	}
 }
 
-inline void region_distribution::region::redistribute_cells(std::vector<std::reference_wrapper<region> > & regions, std::function<float_t (point<float_t>)> coord){
-    std::vector<cell_ref> cells;
+inline void region_distribution::region::redistribute_cells(std::vector<std::reference_wrapper<region> > const & regions, std::vector<cell_ref> & cells, std::function<float_t (point<float_t>)> coord){
+    cells.clear();
 	for(region & reg_ref : regions){
 		if(reg_ref.capacity() > 0){
 			cells.insert(cells.end(), reg_ref.cell_references_.begin(), reg_ref.cell_references_.end());
@@ -697,72 +772,90 @@ inline void region_distribution::region::redistribute_cells(std::vector<std::ref
 
 void region_distribution::redo_line_partitions(){
     // Optimize a single line or column
-    #pragma omp parallel for
+    #pragma omp parallel
+    {
+    // Per-thread storage, reused for every line
+    std::vector<std::reference_wrapper<region> > regs;
+    std::vector<cell_ref> cells;
+    #pragma omp for
     for(index_t y=0; y<y_regions_cnt(); ++y){
-        std::vector<std::reference_wrapper<region> > regs;
+        regs.clear();
         for(index_t x=0; x<x_regions_cnt(); ++x){
             regs.push_back(std::reference_wrapper<region>(get_region(x, y)));
         }
-        region::redistribute_cells(regs, [](point<float_t> p){ return p.x_; });
+        region::redistribute_cells(regs, cells, [](point<float_t> p){ return p.x_; });
     }
-    #pragma omp parallel for
+    #pragma omp for
     for(index_t x=0; x<x_regions_cnt(); ++x){
-        std::vector<std::reference_wrapper<region> > regs;
+        regs.clear();
         for(index_t y=0; y<y_regions_cnt(); ++y){
             regs.push_back(std::reference_wrapper<region>(get_region(x, y)));
         }
-        region::redistribute_cells(regs, [](point<float_t> p){ return p.y_; });
+        region::redistribute_cells(regs, cells, [](point<float_t> p){ return p.y_; });
+    }
     }
 }
 
 void region_distribution::x_resize(index_t sz){
     assert(sz > 0);
-    std::vector<region> old_placement_regions = prepare_regions(sz, y_regions_cnt());
-    placement_regions_.swap(old_placement_regions);
+    prepare_regions(spare_regions_, sz, y_regions_cnt());
+    placement_regions_.swap(spare_regions_);
+    std::vector<region> const & old_placement_regions = spare_regions_;
 
     index_t old_x_regions_cnt = x_regions_cnt();
 
     x_regions_cnt_ = sz;
 
-    #pragma omp parallel for
+    #pragma omp parallel
+    {
+    std::vector<std::reference_wrapper<region> > regs;
+    std::vector<cell_ref> cells;
+    #pragma omp for
     for(index_t y=0; y<y_regions_cnt(); ++y){
-        std::vector<cell_ref> cells;
+        cells.clear();
         for(index_t x=0; x<old_x_regions_cnt; ++x){
             std::vector<cell_ref> const & cur = old_placement_regions[y*old_x_regions_cnt + x].cell_references_;
             cells.insert(cells.end(), cur.begin(), cur.end());
         }
 
-        std::vector<std::reference_wrapper<region> > regs;
+        regs.clear();
         for(index_t x=0; x<x_regions_cnt(); ++x){
             regs.push_back(std::reference_wrapper<region>(get_region(x, y)));
         }
         region::distribute_new_cells(regs, cells, [](point<float_t> p){ return p.x_; });
     }
+    }
 }
 
 void region_distribution::y_resize(index_t sz){
     assert(sz > 0);
-    std::vector<region> old_placement_regions = prepare_regions(x_regions_cnt(), sz);
-    placement_regions_.swap(old_placement_regions);
+    prepare_regions(spare_regions_, x_regions_cnt(), sz);
+    placement_regions_.swap(spare_regions_);
+    std::vector<region> const & old_placement_regions = spare_regions_;
 
     index_t old_y_regions_cnt = y_regions_cnt();
 
     y_regions_cnt_ = sz;
 
-    #pragma omp parallel for
+    #pragma omp parallel
+    {
+    std::vector<std::reference_wrapper<region> > regs;
+    std::vector<cell_ref> cells;
+    #pragma omp for
     for(index_t x=0; x<x_regions_cnt(); ++x){
-        std::vector<cell_ref> cells;
+        cells.clear();
         for(index_t y=0; y<old_y_regions_cnt; ++y){
             std::vector<cell_ref> const & cur = old_placement_regions[y*x_regions_cnt() + x].cell_references_;
             cells.insert(cells.end(), cur.begin(), cur.end());
         }
 
-        std::vector<std::reference_wrapper<region> > regs;
+        regs.clear();
         for(index_t y=0; y<y_regions_cnt(); ++y){
             regs.push_back(std::reference_wrapper<region>(get_region(x, y)));
         }
         region::distribute_new_cells(regs, cells, [](point<float_t> p){ return p.y_; });
     }
+    }
 }
 
 void region_distribution::redo_diag_partitions(index_t len){
@@ -828,7 +921,7 @@ region_distribution::region_distribution(
         }
     }
 
-    placement_regions_ = prepare_regions(1, 1);
+    prepare_regions(placement_regions_, 1, 1);
 
     if(full_density){
         cell_density_mul = default_density_mul;
@@ -847,6 +940,7 @@ region_distribution::region_distribution(
         }
         placement_regions_[0].cell_references_.push_back( cell_ref(c.demand_ * cell_density_mul, c.pos_, i) );
     }
+    placement_regions_[0].update_allocated_capacity();
 }
 
 region_distribution region_distribution::full_density_distribution(box<int_t> placement_area, netlist const & circuit, placement_t const & pl, std::vector<density_limit> const & density_map){
@@ -3,53 +3,140 @@
 
 #include <cassert>
 #include <stdexcept>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <cmath>
+#include <chrono>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 namespace coloquinte{
 namespace gp{
 
-linear_system linear_system::operator+(linear_system const & o) const{
-    if(o.internal_size() != internal_size()){ throw std::runtime_error("Mismatched system sizes"); }
-    linear_system ret(target_.size() + o.target_.size() - internal_size(), internal_size());
+void linear_system::append_triplets(std::vector<matrix_triplet> const & triplets, std::vector<std::pair<index_t, index_t> > const & offsets, index_t offset){
+    index_t base = matrix_.size();
+    matrix_.insert(matrix_.end(), triplets.begin(), triplets.end());
+    if(offset == 0 and offsets.empty()) return;
 
-    ret.matrix_ = matrix_;
-    std::vector<matrix_triplet> omatrix = o.matrix_;
-    for(matrix_triplet & t : omatrix){
-        if(t.c_ >= internal_size()){
-            t.c_ += (target_.size() - internal_size());
-        }
-        if(t.r_ >= internal_size()){
-            t.r_ += (target_.size() - internal_size());
-        }
+    // The appended triplets use the new offset, on top of the ones that were still pending in their own system
+    variable_offsets_.push_back(std::pair<index_t, index_t>(base, offset));
+    for(auto const & O : offsets){
+        variable_offsets_.push_back(std::pair<index_t, index_t>(base + O.first, offset + O.second));
     }
-    ret.matrix_.insert(ret.matrix_.end(), omatrix.begin(), omatrix.end());
+    // The triplets added later already use the final numbering
+    variable_offsets_.push_back(std::pair<index_t, index_t>(matrix_.size(), 0));
+}
 
-    // ret.target_.resize(target_.size() + o.target_.size() - internal_size);
+void linear_system::append_target(std::vector<float_t> const & target){
     for(index_t i=0; i<internal_size(); ++i){
-        ret.target_[i] = target_[i] + o.target_[i];
+        target_[i] += target[i];
+    }
+    target_.insert(target_.end(), target.begin() + internal_size(), target.end());
+}
+
+void linear_system::apply_variable_offsets(){
+    for(index_t k=0; k<variable_offsets_.size(); ++k){
+        index_t offset = variable_offsets_[k].second;
+        index_t end = k+1 < variable_offsets_.size() ? variable_offsets_[k+1].first : matrix_.size();
+        if(offset == 0) continue;
+        #pragma omp parallel for
+        for(index_t i=variable_offsets_[k].first; i<end; ++i){
+            matrix_triplet & t = matrix_[i];
+            if(t.c_ >= internal_size()){
+                t.c_ += offset;
+            }
+            if(t.r_ >= internal_size()){
+                t.r_ += offset;
+            }
+        }
+    }
+    variable_offsets_.clear();
+}
+
+linear_system & linear_system::operator+=(linear_system const & o){
+    if(o.internal_size() != internal_size()){ throw std::runtime_error("Mismatched system sizes"); }
+    assert(not record_target_ and not o.record_target_);
+    append_triplets(o.matrix_, o.variable_offsets_, target_.size() - internal_size());
+    append_target(o.target_);
+    return *this;
+}
+
+linear_system & linear_system::operator+=(linear_system && o){
+    if(o.internal_size() != internal_size()){ throw std::runtime_error("Mismatched system sizes"); }
+    assert(not record_target_ and not o.record_target_);
+    if(matrix_.empty() and target_.size() == internal_size()){
+        // Nothing to renumber: just take the other system's storage
+        for(index_t i=0; i<internal_size(); ++i){
+            o.target_[i] += target_[i];
+        }
+        matrix_ = std::move(o.matrix_);
+        target_ = std::move(o.target_);
+        variable_offsets_ = std::move(o.variable_offsets_);
     }
-    for(index_t i=internal_size(); i<target_.size(); ++i){
-        ret.target_[i] = target_[i];
+    else{
+        if(matrix_.capacity() < matrix_.size() + o.matrix_.size() and o.matrix_.capacity() >= matrix_.size() + o.matrix_.size()){
+            // Only the other buffer is large enough: our triplets are moved in front of the other's, which are renumbered lazily
+            std::vector<std::pair<index_t, index_t> > offsets = variable_offsets_;
+            index_t offset = target_.size() - internal_size();
+            index_t base = matrix_.size();
+            o.matrix_.insert(o.matrix_.begin(), matrix_.begin(), matrix_.end());
+            matrix_ = std::move(o.matrix_);
+            if(offset != 0 or not o.variable_offsets_.empty()){
+                if(offsets.empty() or offsets.back().first != base){
+                    offsets.push_back(std::pair<index_t, index_t>(base, 0));
+                }
+                offsets.back().second = offset;
+                for(auto const & O : o.variable_offsets_){
+                    offsets.push_back(std::pair<index_t, index_t>(base + O.first, offset + O.second));
+                }
+                offsets.push_back(std::pair<index_t, index_t>(matrix_.size(), 0));
+            }
+            variable_offsets_ = std::move(offsets);
+        }
+        else{
+            append_triplets(o.matrix_, o.variable_offsets_, target_.size() - internal_size());
+        }
+        append_target(o.target_);
     }
-    for(index_t i=internal_size(); i<o.target_.size(); ++i){
-        ret.target_[i + target_.size() - internal_size()] = o.target_[i];
+    o.matrix_.clear();
+    o.target_.assign(internal_size(), 0.0);
+    o.variable_offsets_.clear();
+    return *this;
+}
+
+void linear_system::append_buffer(linear_system const & o){
+    assert(o.record_target_ and o.variable_offsets_.empty());
+    if(o.internal_size() != internal_size()){ throw std::runtime_error("Mismatched system sizes"); }
+    matrix_.insert(matrix_.end(), o.matrix_.begin(), o.matrix_.end());
+    for(matrix_doublet const d : o.recorded_target_){
+        add_doublet(d.c_, d.val_);
     }
+}
 
+linear_system linear_system::operator+(linear_system const & o) const{
+    linear_system ret = *this;
+    ret += o;
     return ret;
 }
 
+linear_system operator+(linear_system && a, linear_system const & b){
+    a += b;
+    return std::move(a);
+}
 
-// The classical compressed sparse row storage
-struct csr_matrix{
-    std::vector<std::uint32_t> row_limits, col_indexes;
-    std::vector<float> values, diag;
+linear_system operator+(linear_system && a, linear_system && b){
+    a += std::move(b);
+    return std::move(a);
+}
 
-    std::vector<float> mul(std::vector<float> const & x) const;
-    std::vector<float> solve_CG(std::vector<float> const & goal, std::vector<float> guess, std::uint32_t min_iter, std::uint32_t max_iter, float tol) const;
-    csr_matrix(std::vector<std::uint32_t> const & row_l, std::vector<std::uint32_t> const & col_i, std::vector<float> const & vals, std::vector<float> const D) : row_limits(row_l), col_indexes(col_i), values(vals), diag(D){
-        assert(values.size() == col_indexes.size());
-        assert(diag.size()+1 == row_limits.size());
-    }
-};
+linear_system operator+(linear_system const & a, linear_system && b){
+    linear_system ret = a;
+    ret += std::move(b);
+    return ret;
+}
 
 // A matrix with successive rows padded to the same length and accessed column-major; hopefully a little better
 template<std::uint32_t unroll_len>
@@ -217,16 +304,437 @@ ellpack_matrix<unroll_len> doublet_matrix::get_ellpack_matrix() const{
     return ellpack_matrix<unroll_len>(new_row_limits, col_indices, values, diag);
 }
 
+symbolic_matrix::symbolic_matrix(std::vector<matrix_triplet> const & triplets, index_t n) : size_(n){
+    triplet_rows_.resize(triplets.size());
+    triplet_cols_.resize(triplets.size());
+
+    // Bucket the triplets by row, keeping their order
+    std::vector<index_t> bucket_limits(n+1, 0);
+    for(index_t i=0; i<triplets.size(); ++i){
+        triplet_rows_[i] = triplets[i].r_;
+        triplet_cols_[i] = triplets[i].c_;
+        assert(triplets[i].r_ < n and triplets[i].c_ < n);
+        ++bucket_limits[triplets[i].r_+1];
+    }
+    std::partial_sum(bucket_limits.begin(), bucket_limits.end(), bucket_limits.begin());
+    std::vector<index_t> bucketed(triplets.size()), bucket_pos(bucket_limits.begin(), bucket_limits.end()-1);
+    for(index_t i=0; i<triplets.size(); ++i){
+        bucketed[bucket_pos[triplets[i].r_]++] = i;
+    }
+
+    // Sort each row by column and group the triplets in slots; the diagonal slots are kept apart
+    std::vector<index_t> diag_limits(n+1, 0), diag_triplets;
+    std::vector<index_t> off_limits(1, 0), off_triplets;
+    row_limits_.resize(n+1, 0);
+    std::vector<std::pair<index_t, index_t> > row_elts;
+    for(index_t i=0; i<n; ++i){
+        row_elts.clear();
+        for(index_t j=bucket_limits[i]; j<bucket_limits[i+1]; ++j){
+            row_elts.push_back(std::pair<index_t, index_t>(triplet_cols_[bucketed[j]], bucketed[j]));
+        }
+        std::sort(row_elts.begin(), row_elts.end());
+        for(index_t j=0; j<row_elts.size(); ++j){
+            index_t c = row_elts[j].first;
+            if(c == i){
+                diag_triplets.push_back(row_elts[j].second);
+            }
+            else{
+                if(j == 0 or row_elts[j-1].first != c){
+                    col_indexes_.push_back(c);
+                    off_limits.push_back(off_triplets.size());
+                }
+                off_triplets.push_back(row_elts[j].second);
+                off_limits.back() = off_triplets.size();
+            }
+        }
+        diag_limits[i+1] = diag_triplets.size();
+        row_limits_[i+1] = col_indexes_.size();
+    }
+
+    // Concatenate the diagonal and off-diagonal slots
+    slot_limits_ = diag_limits;
+    for(index_t j=1; j<off_limits.size(); ++j){
+        slot_limits_.push_back(off_limits[j] + diag_triplets.size());
+    }
+    slot_triplets_ = diag_triplets;
+    slot_triplets_.insert(slot_triplets_.end(), off_triplets.begin(), off_triplets.end());
+    assert(slot_limits_.size() == size_ + col_indexes_.size() + 1);
+    assert(slot_triplets_.size() == triplets.size());
+}
+
+bool symbolic_matrix::matches(std::vector<matrix_triplet> const & triplets, index_t n) const{
+    if(n != size_ or triplets.size() != triplet_rows_.size()) return false;
+    bool same = true;
+    #pragma omp parallel for reduction(&&:same)
+    for(index_t i=0; i<triplets.size(); ++i){
+        same = same and triplets[i].r_ == triplet_rows_[i] and triplets[i].c_ == triplet_cols_[i];
+    }
+    return same;
+}
+
+csr_matrix symbolic_matrix::get_compressed_matrix(std::vector<matrix_triplet> const & triplets) const{
+    csr_matrix ret;
+    get_compressed_matrix(triplets, ret);
+    return ret;
+}
+
+void symbolic_matrix::get_compressed_matrix(std::vector<matrix_triplet> const & triplets, csr_matrix & mat) const{
+    assert(triplets.size() == triplet_rows_.size());
+    mat.row_limits = row_limits_;
+    mat.col_indexes = col_indexes_;
+    mat.values.resize(col_indexes_.size());
+    mat.diag.resize(size_);
+    std::vector<float> & values = mat.values, & diag = mat.diag;
+
+    #pragma omp parallel for
+    for(index_t s=0; s<slot_limits_.size()-1; ++s){
+        float val = 0.0;
+        for(index_t j=slot_limits_[s]; j<slot_limits_[s+1]; ++j){
+            val += triplets[slot_triplets_[j]].val_;
+        }
+        if(s < size_) diag[s] = val;
+        else          values[s-size_] = val;
+    }
+}
+
+template<typename T>
+std::uint64_t vector_bytes(std::vector<T> const & v){
+    return v.size() * sizeof(T);
+}
+
+std::uint64_t csr_matrix::storage_bytes() const{
+    return vector_bytes(row_limits) + vector_bytes(col_indexes) + vector_bytes(values) + vector_bytes(diag);
+}
+
 std::vector<float> csr_matrix::mul(std::vector<float> const & x) const{
-    std::vector<float> res(x.size());
+    std::vector<float> res;
+    mul(x, res);
+    return res;
+}
+
+void csr_matrix::mul(std::vector<float> const & x, std::vector<float> & res) const{
     assert(x.size() == diag.size());
+    res.resize(x.size());
+    #pragma omp parallel for schedule(static, 1024)
     for(std::uint32_t i=0; i<diag.size(); ++i){
         res[i] = diag[i] * x[i];
         for(std::uint32_t j=row_limits[i]; j<row_limits[i+1]; ++j){
             res[i] += values[j] * x[col_indexes[j]];
         }
     }
-    return res;
+}
+
+/*
+ * Compressed sparse rows with the column indexes stored as small offsets from the row
+ *
+ * With locality-ordered cells most connections are to close indexes: the offsets fit in 8 or 16 bits.
+ * Offsets that don't fit are replaced by an escape marker, and the full index is stored apart.
+ */
+template<typename delta_t>
+struct delta_csr_matrix{
+    std::vector<std::uint32_t> row_limits, escape_limits, escapes;
+    std::vector<delta_t> deltas;
+    std::vector<float> values, diag;
+
+    static const delta_t escape_marker = std::numeric_limits<delta_t>::min();
+    static bool is_escape(std::uint32_t r, std::uint32_t c){
+        std::int64_t d = static_cast<std::int64_t>(c) - static_cast<std::int64_t>(r);
+        return d <= escape_marker or d > std::numeric_limits<delta_t>::max();
+    }
+    // Memory used by the column indexes in this format
+    static std::uint64_t index_bytes(csr_matrix const & A);
+
+    delta_csr_matrix(csr_matrix const & A);
+    void mul(std::vector<float> const & x, std::vector<float> & res) const;
+    std::uint64_t storage_bytes() const{
+        return vector_bytes(row_limits) + vector_bytes(escape_limits) + vector_bytes(escapes) + vector_bytes(deltas) + vector_bytes(values) + vector_bytes(diag);
+    }
+};
+
+template<typename delta_t>
+std::uint64_t delta_csr_matrix<delta_t>::index_bytes(csr_matrix const & A){
+    std::uint64_t escape_cnt = 0;
+    for(std::uint32_t i=0; i<A.diag.size(); ++i){
+        for(std::uint32_t j=A.row_limits[i]; j<A.row_limits[i+1]; ++j){
+            if(is_escape(i, A.col_indexes[j])) ++escape_cnt;
+        }
+    }
+    return A.col_indexes.size() * sizeof(delta_t) + escape_cnt * sizeof(std::uint32_t) + A.diag.size() * sizeof(std::uint32_t);
+}
+
+template<typename delta_t>
+delta_csr_matrix<delta_t>::delta_csr_matrix(csr_matrix const & A) : row_limits(A.row_limits), deltas(A.col_indexes.size()), values(A.values), diag(A.diag){
+    escape_limits.push_back(0);
+    for(std::uint32_t i=0; i<diag.size(); ++i){
+        for(std::uint32_t j=row_limits[i]; j<row_limits[i+1]; ++j){
+            std::uint32_t c = A.col_indexes[j];
+            if(is_escape(i, c)){
+                deltas[j] = escape_marker;
+                escapes.push_back(c);
+            }
+            else{
+                deltas[j] = static_cast<delta_t>(static_cast<std::int64_t>(c) - static_cast<std::int64_t>(i));
+            }
+        }
+        escape_limits.push_back(escapes.size());
+    }
+}
+
+template<typename delta_t>
+void delta_csr_matrix<delta_t>::mul(std::vector<float> const & x, std::vector<float> & res) const{
+    assert(x.size() == diag.size());
+    res.resize(x.size());
+    #pragma omp parallel for schedule(static, 1024)
+    for(std::uint32_t i=0; i<diag.size(); ++i){
+        float cur = diag[i] * x[i];
+        std::uint32_t e = escape_limits[i];
+        for(std::uint32_t j=row_limits[i]; j<row_limits[i+1]; ++j){
+            delta_t d = deltas[j];
+            std::uint32_t c = d != escape_marker ? i + d : escapes[e++];
+            cur += values[j] * x[c];
+        }
+        res[i] = cur;
+    }
+}
+
+/*
+ * A symmetric matrix stored as its diagonal and strict upper triangle
+ *
+ * Each off-diagonal element is applied twice in the product, to its row and to its column.
+ * The rows are split in blocks processed in parallel: contributions to columns of the same block are written directly,
+ * the others go to a buffer of the block and are summed afterwards in a fixed order, so that the result doesn't depend on the number of threads.
+ */
+struct symmetric_csr_matrix{
+    static const std::uint32_t block_size = 4096;
+
+    // Elements whose column is in the same block as their row
+    std::vector<std::uint32_t> row_limits, col_indexes;
+    std::vector<float> values, diag;
+    // Elements whose column is in a later block, with the position of the column in the buffers
+    std::vector<std::uint32_t> ext_row_limits, ext_col_indexes, ext_slots;
+    std::vector<float> ext_values;
+    // The columns of each position in the buffers, and the positions used by each block
+    std::vector<std::uint32_t> slot_cols, block_slot_limits;
+    // The buffers of the products, kept between them
+    mutable std::vector<float> buffers;
+
+    symmetric_csr_matrix(csr_matrix const & A);
+    void mul(std::vector<float> const & x, std::vector<float> & res) const;
+    std::uint64_t storage_bytes() const{
+        return vector_bytes(row_limits) + vector_bytes(col_indexes) + vector_bytes(values) + vector_bytes(diag)
+             + vector_bytes(ext_row_limits) + vector_bytes(ext_col_indexes) + vector_bytes(ext_slots) + vector_bytes(ext_values)
+             + vector_bytes(slot_cols) + vector_bytes(block_slot_limits);
+    }
+};
+
+symmetric_csr_matrix::symmetric_csr_matrix(csr_matrix const & A) : diag(A.diag){
+    std::uint32_t n = diag.size();
+    std::uint32_t block_cnt = (n + block_size - 1) / block_size;
+    row_limits.push_back(0);
+    ext_row_limits.push_back(0);
+    block_slot_limits.push_back(0);
+    std::vector<std::uint32_t> col_slots(n, std::numeric_limits<std::uint32_t>::max());
+    for(std::uint32_t b=0; b<block_cnt; ++b){
+        std::uint32_t block_end = std::min(n, (b+1) * block_size);
+        for(std::uint32_t i=b*block_size; i<block_end; ++i){
+            for(std::uint32_t j=A.row_limits[i]; j<A.row_limits[i+1]; ++j){
+                std::uint32_t c = A.col_indexes[j];
+                if(c <= i) continue;
+                if(c < block_end){
+                    col_indexes.push_back(c);
+                    values.push_back(A.values[j]);
+                }
+                else{
+                    // A single buffer position for all elements of the block in this column
+                    if(col_slots[c] == std::numeric_limits<std::uint32_t>::max() or col_slots[c] < block_slot_limits.back()){
+                        col_slots[c] = slot_cols.size();
+                        slot_cols.push_back(c);
+                    }
+                    ext_col_indexes.push_back(c);
+                    ext_slots.push_back(col_slots[c]);
+                    ext_values.push_back(A.values[j]);
+                }
+            }
+            row_limits.push_back(col_indexes.size());
+            ext_row_limits.push_back(ext_col_indexes.size());
+        }
+        block_slot_limits.push_back(slot_cols.size());
+    }
+}
+
+void symmetric_csr_matrix::mul(std::vector<float> const & x, std::vector<float> & res) const{
+    assert(x.size() == diag.size());
+    std::uint32_t n = diag.size();
+    std::uint32_t block_cnt = block_slot_limits.size() - 1;
+    res.resize(n);
+    buffers.assign(slot_cols.size(), 0.0f);
+
+    #pragma omp parallel for schedule(static)
+    for(std::uint32_t b=0; b<block_cnt; ++b){
+        std::uint32_t block_end = std::min(n, (b+1) * block_size);
+        for(std::uint32_t i=b*block_size; i<block_end; ++i){
+            res[i] = diag[i] * x[i];
+        }
+        for(std::uint32_t i=b*block_size; i<block_end; ++i){
+            float cur = 0.0f, xi = x[i];
+            for(std::uint32_t j=row_limits[i]; j<row_limits[i+1]; ++j){
+                cur += values[j] * x[col_indexes[j]];
+                res[col_indexes[j]] += values[j] * xi;
+            }
+            for(std::uint32_t j=ext_row_limits[i]; j<ext_row_limits[i+1]; ++j){
+                cur += ext_values[j] * x[ext_col_indexes[j]];
+                buffers[ext_slots[j]] += ext_values[j] * xi;
+            }
+            res[i] += cur;
+        }
+    }
+    for(std::uint32_t k=0; k<slot_cols.size(); ++k){
+        res[slot_cols[k]] += buffers[k];
+    }
+}
+
+/*
+ * Sliced ELLPACK with the rows sorted by length inside windows (SELL-C-sigma)
+ *
+ * The rows are grouped in slices of slice_height rows, stored column-major and padded to the longest row of the slice, so that a slice is processed with one vector lane per row.
+ * Sorting the rows by decreasing length inside windows of sort_window rows limits the padding on skewed degrees, while the rows stay close to their original order.
+ * The slice height is the width of the widest vector instructions enabled at compilation (CMake options COLOQUINTE_AVX2 and COLOQUINTE_AVX512).
+ * All versions multiply and add separately, in the same order for each row, so that the products don't depend on the instruction set.
+ */
+struct sell_matrix{
+#if defined(__AVX512F__)
+    static const std::uint32_t slice_height = 16;
+#else
+    static const std::uint32_t slice_height = 8;
+#endif
+    static const std::uint32_t sort_window = 32 * slice_height;
+
+    // The original row of each stored row; the padding rows at the end repeat the last row
+    std::vector<std::uint32_t> rows;
+    // The first element of each slice; the elements of a slice are stored column by column
+    std::vector<std::uint32_t> slice_limits, col_indexes;
+    std::vector<float> values, stored_diag;
+    // The diagonal in the original order, for the preconditioner
+    std::vector<float> diag;
+
+    static std::vector<std::uint32_t> sorted_rows(csr_matrix const & A);
+    // Number of elements stored in this format, padding included
+    static std::uint64_t padded_size(csr_matrix const & A);
+
+    sell_matrix(csr_matrix const & A);
+    void mul(std::vector<float> const & x, std::vector<float> & res) const;
+    std::uint64_t storage_bytes() const{
+        return vector_bytes(rows) + vector_bytes(slice_limits) + vector_bytes(col_indexes) + vector_bytes(values) + vector_bytes(stored_diag) + vector_bytes(diag);
+    }
+};
+
+std::vector<std::uint32_t> sell_matrix::sorted_rows(csr_matrix const & A){
+    std::uint32_t n = A.diag.size();
+    std::vector<std::uint32_t> ret(n);
+    std::iota(ret.begin(), ret.end(), 0);
+    auto longer = [&](std::uint32_t a, std::uint32_t b){
+        return A.row_limits[a+1] - A.row_limits[a] > A.row_limits[b+1] - A.row_limits[b];
+    };
+    for(std::uint32_t w=0; w<n; w += sort_window){
+        std::stable_sort(ret.begin() + w, ret.begin() + std::min(n, w + sort_window), longer);
+    }
+    return ret;
+}
+
+std::uint64_t sell_matrix::padded_size(csr_matrix const & A){
+    std::vector<std::uint32_t> order = sorted_rows(A);
+    std::uint64_t ret = 0;
+    for(std::uint32_t s=0; s<order.size(); s += slice_height){
+        // The longest row of a slice comes first
+        std::uint32_t r = order[s];
+        ret += static_cast<std::uint64_t>(slice_height) * (A.row_limits[r+1] - A.row_limits[r]);
+    }
+    return ret;
+}
+
+sell_matrix::sell_matrix(csr_matrix const & A) : rows(sorted_rows(A)), diag(A.diag){
+    std::uint32_t n = diag.size();
+    std::uint32_t slice_cnt = (n + slice_height - 1) / slice_height;
+    if(n > 0){
+        rows.resize(slice_cnt * slice_height, rows.back());
+    }
+    for(std::uint32_t r : rows){
+        stored_diag.push_back(diag[r]);
+    }
+
+    slice_limits.push_back(0);
+    for(std::uint32_t s=0; s<slice_cnt; ++s){
+        std::uint32_t width = 0;
+        for(std::uint32_t l=0; l<slice_height; ++l){
+            std::uint32_t r = rows[s*slice_height + l];
+            width = std::max(width, A.row_limits[r+1] - A.row_limits[r]);
+        }
+        std::uint32_t begin = slice_limits.back();
+        slice_limits.push_back(begin + width * slice_height);
+        // Padding elements have a null value on a valid column
+        col_indexes.resize(slice_limits.back());
+        values.resize(slice_limits.back(), 0.0f);
+        for(std::uint32_t l=0; l<slice_height; ++l){
+            std::uint32_t r = rows[s*slice_height + l];
+            std::uint32_t len = A.row_limits[r+1] - A.row_limits[r];
+            for(std::uint32_t k=0; k<width; ++k){
+                std::uint32_t ind = begin + k*slice_height + l;
+                if(k < len){
+                    col_indexes[ind] = A.col_indexes[A.row_limits[r] + k];
+                    values[ind] = A.values[A.row_limits[r] + k];
+                }
+                else{
+                    col_indexes[ind] = r;
+                }
+            }
+        }
+    }
+}
+
+void sell_matrix::mul(std::vector<float> const & x, std::vector<float> & res) const{
+    assert(x.size() == diag.size());
+    std::uint32_t slice_cnt = slice_limits.size() - 1;
+    res.resize(x.size());
+    float const * xp = x.data();
+
+    #pragma omp parallel for schedule(static, 64)
+    for(std::uint32_t s=0; s<slice_cnt; ++s){
+        std::uint32_t const * slice_rows = rows.data() + s*slice_height;
+        float acc[slice_height];
+#if defined(__AVX512F__)
+        __m512 sum = _mm512_mul_ps(_mm512_loadu_ps(stored_diag.data() + s*slice_height), _mm512_i32gather_ps(_mm512_loadu_si512(slice_rows), xp, 4));
+        for(std::uint32_t j=slice_limits[s]; j<slice_limits[s+1]; j += slice_height){
+            __m512i cols = _mm512_loadu_si512(col_indexes.data() + j);
+            __m512 prod = _mm512_mul_ps(_mm512_loadu_ps(values.data() + j), _mm512_i32gather_ps(cols, xp, 4));
+            sum = _mm512_add_ps(sum, prod);
+        }
+        _mm512_storeu_ps(acc, sum);
+#elif defined(__AVX2__)
+        __m256 sum = _mm256_mul_ps(
+            _mm256_loadu_ps(stored_diag.data() + s*slice_height),
+            _mm256_i32gather_ps(xp, _mm256_loadu_si256(reinterpret_cast<__m256i const *>(slice_rows)), 4)
+        );
+        for(std::uint32_t j=slice_limits[s]; j<slice_limits[s+1]; j += slice_height){
+            __m256i cols = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(col_indexes.data() + j));
+            __m256 prod = _mm256_mul_ps(_mm256_loadu_ps(values.data() + j), _mm256_i32gather_ps(xp, cols, 4));
+            sum = _mm256_add_ps(sum, prod);
+        }
+        _mm256_storeu_ps(acc, sum);
+#else
+        for(std::uint32_t l=0; l<slice_height; ++l){
+            acc[l] = stored_diag[s*slice_height + l] * xp[slice_rows[l]];
+        }
+        for(std::uint32_t j=slice_limits[s]; j<slice_limits[s+1]; j += slice_height){
+            for(std::uint32_t l=0; l<slice_height; ++l){
+                acc[l] += values[j+l] * xp[col_indexes[j+l]];
+            }
+        }
+#endif
+        // The padding rows of the last slice repeat a row with the same result
+        for(std::uint32_t l=0; l<slice_height; ++l){
+            res[slice_rows[l]] = acc[l];
+        }
+    }
 }
 
 template<std::uint32_t unroll_len>
@@ -269,71 +777,1891 @@ float dot_prod(std::vector<float> const & a, std::vector<float> const & b){
     return res;
 }
 
-std::vector<float> csr_matrix::solve_CG(std::vector<float> const & goal, std::vector<float> x, std::uint32_t min_iter, std::uint32_t max_iter, float tol_ratio) const{
-    std::uint32_t n = diag.size();
-    assert(goal.size() == n);
-    assert(x.size() == n);
-    std::vector<float> r, p(n), z(n), mul_res, preconditioner(n);
-    r = mul(x);
-    for(uint32_t i=0; i<n; ++i){
-        r[i] = goal[i] - r[i];
-        preconditioner[i] = 1.0/diag[i];
-        assert(std::isfinite(preconditioner[i]));
-        z[i] = preconditioner[i] * r[i];
-        p[i] = z[i];
+namespace{
+/*
+ * The vector operations of the conjugate gradient run in parallel on blocks of fixed size
+ *
+ * The updates of the vectors and the dot product that follows them are fused in a single pass over each block, while it is in cache.
+ * The partial sums of the blocks are added in order, so that the results don't depend on the number of threads.
+ */
+std::uint32_t const vector_block_size = 4096;
+
+std::uint32_t vector_block_cnt(std::uint32_t n){
+    return (n + vector_block_size - 1) / vector_block_size;
+}
+
+// Same independent partial sums as dot_prod<16>, on a range; the mixed precision solver accumulates them in double
+template<typename acc_t = float>
+acc_t range_dot_prod(float const * a, float const * b, std::uint32_t n){
+    std::uint32_t const unroll_len = 16;
+    acc_t vals[unroll_len];
+    for(std::uint32_t j=0; j<unroll_len; ++j) vals[j] = 0.0;
+    for(std::uint32_t i=0; i<n / unroll_len; ++i){
+        for(std::uint32_t j=0; j<unroll_len; ++j){
+            vals[j] += static_cast<acc_t>(a[unroll_len*i + j]) * b[unroll_len*i + j];
+        }
+    }
+    acc_t res = 0.0;
+    for(std::uint32_t j=0; j<unroll_len; ++j) res += vals[j];
+    for(std::uint32_t i = unroll_len*(n / unroll_len); i<n; ++i){
+        res += static_cast<acc_t>(a[i]) * b[i];
     }
+    return res;
+}
 
-    float cross_norm = dot_prod<16>(r, z);
-    assert(std::isfinite(cross_norm));
-    float_t const epsilon = std::numeric_limits<float_t>::min();
+// The same for two interleaved vectors of n elements each, in a single pass with the same partial sums
+void range_dot_prod_pair(float const * a, float const * b, std::uint32_t n, float res[2]){
+    std::uint32_t const unroll_len = 16;
+    float vals[2*unroll_len];
+    for(std::uint32_t j=0; j<2*unroll_len; ++j) vals[j] = 0.0;
+    for(std::uint32_t i=0; i<n / unroll_len; ++i){
+        for(std::uint32_t j=0; j<2*unroll_len; ++j){
+            vals[j] += a[2*unroll_len*i + j] * b[2*unroll_len*i + j];
+        }
+    }
+    res[0] = 0.0;
+    res[1] = 0.0;
+    for(std::uint32_t j=0; j<unroll_len; ++j){
+        res[0] += vals[2*j];
+        res[1] += vals[2*j+1];
+    }
+    for(std::uint32_t i = unroll_len*(n / unroll_len); i<n; ++i){
+        res[0] += a[2*i] * b[2*i];
+        res[1] += a[2*i+1] * b[2*i+1];
+    }
+}
 
-    float start_norm = cross_norm;
-    for(uint32_t k=0; k < max_iter; ++k){
-        mul_res = mul(p);
+template<typename acc_t>
+acc_t sum_blocks(std::vector<acc_t> const & partial_sums){
+    acc_t res = 0.0;
+    for(acc_t const s : partial_sums) res += s;
+    return res;
+}
+
+template<typename acc_t>
+acc_t parallel_dot_prod(std::vector<float> const & a, std::vector<float> const & b, std::vector<acc_t> & partial_sums){
+    assert(a.size() == b.size());
+    std::uint32_t n = a.size();
+    partial_sums.resize(vector_block_cnt(n));
+    #pragma omp parallel for
+    for(std::uint32_t k=0; k<partial_sums.size(); ++k){
+        std::uint32_t begin = k * vector_block_size, end = std::min(n, begin + vector_block_size);
+        partial_sums[k] = range_dot_prod<acc_t>(a.data() + begin, b.data() + begin, end - begin);
+    }
+    return sum_blocks(partial_sums);
+}
 
-        float_t pr_prod = dot_prod<16>(p, mul_res);
-        float_t alpha = cross_norm / pr_prod;
+// The storage of the partial sums in a workspace, for each precision of the reductions
+template<typename acc_t>
+struct reduction_storage;
 
-        if(
-            not std::isfinite(cross_norm) or not std::isfinite(alpha) or not std::isfinite(pr_prod)
-            or cross_norm <= epsilon or alpha <= epsilon or pr_prod <= epsilon
-            ){
-            break;
+template<>
+struct reduction_storage<float>{
+    static std::vector<float> & sums(solver_workspace & ws){ return ws.partial_sums; }
+    static std::vector<float> & sq_norms(solver_workspace & ws){ return ws.partial_sq_norms; }
+};
+
+template<>
+struct reduction_storage<double>{
+    static std::vector<double> & sums(solver_workspace & ws){ return ws.accurate_sums; }
+    static std::vector<double> & sq_norms(solver_workspace & ws){ return ws.accurate_sq_norms; }
+};
+
+// The inverse of the diagonal, in the storage of a workspace
+struct jacobi_preconditioner{
+    std::vector<float> & inverse_diag;
+
+    jacobi_preconditioner(std::vector<float> const & diag, std::vector<float> & storage) : inverse_diag(storage){
+        inverse_diag.resize(diag.size());
+        #pragma omp parallel for schedule(static, vector_block_size)
+        for(std::uint32_t i=0; i<diag.size(); ++i){
+            inverse_diag[i] = 1.0/diag[i];
+            assert(std::isfinite(inverse_diag[i]));
+        }
+    }
+    void apply(std::vector<float> const & r, std::vector<float> & z) const{
+        #pragma omp parallel for schedule(static, vector_block_size)
+        for(std::uint32_t i=0; i<r.size(); ++i){
+            z[i] = inverse_diag[i] * r[i];
+        }
+    }
+};
+
+// Upper bound of the spectral radius of D^-1 A from the row sums (Gershgorin), at least 1
+float jacobi_spectral_bound(csr_matrix const & A){
+    float radius = 1.0f;
+    for(std::uint32_t i=0; i<A.diag.size(); ++i){
+        float row_sum = std::abs(A.diag[i]);
+        for(std::uint32_t j=A.row_limits[i]; j<A.row_limits[i+1]; ++j){
+            row_sum += std::abs(A.values[j]);
         }
+        radius = std::max(radius, row_sum / A.diag[i]);
+    }
+    return radius;
+}
 
-        // Update the result
-        for(uint32_t i=0; i<n; ++i){
+// The quantities computed during the update of the residual, in the precision of the reductions
+template<typename acc_t>
+struct residual_update{
+    acc_t cross_norm;       // r.z
+    acc_t residual_sq_norm; // r.r
+    float max_step;         // Largest change of a variable
+};
+
+// x += alpha p, r -= alpha Ap; returns r.r and the largest step
+template<typename acc_t>
+residual_update<acc_t> update_CG_iterate(acc_t alpha, std::vector<float> const & p, std::vector<float> const & mul_res, std::vector<float> & x, std::vector<float> & r, solver_workspace & ws){
+    std::uint32_t n = x.size();
+    std::vector<acc_t> & partial_sums = reduction_storage<acc_t>::sums(ws);
+    std::vector<float> & partial_steps = ws.partial_steps;
+    partial_sums.resize(vector_block_cnt(n));
+    partial_steps.resize(vector_block_cnt(n));
+    #pragma omp parallel for
+    for(std::uint32_t k=0; k<partial_sums.size(); ++k){
+        std::uint32_t begin = k * vector_block_size, end = std::min(n, begin + vector_block_size);
+        float max_step = 0.0f;
+        for(std::uint32_t i=begin; i<end; ++i){
             x[i] = x[i] + alpha * p[i];
             r[i] = r[i] - alpha * mul_res[i];
-            z[i] = preconditioner[i] * r[i];
+            max_step = std::max<float>(max_step, std::abs(alpha * p[i]));
         }
-        float new_cross_norm = dot_prod<16>(r, z); 
+        partial_sums[k] = range_dot_prod<acc_t>(r.data() + begin, r.data() + begin, end - begin);
+        partial_steps[k] = max_step;
+    }
+    residual_update<acc_t> ret;
+    ret.residual_sq_norm = sum_blocks(partial_sums);
+    ret.max_step = partial_steps.empty() ? 0.0f : *std::max_element(partial_steps.begin(), partial_steps.end());
+    return ret;
+}
 
-        // Update the scaled residual and the search direction
-        if(k >= min_iter && new_cross_norm <= tol_ratio * start_norm){
-            break;
+// x += alpha p, r -= alpha Ap, z = M^-1 r
+template<typename acc_t, typename preconditioner_t>
+residual_update<acc_t> update_CG_residual(acc_t alpha, std::vector<float> const & p, std::vector<float> const & mul_res, preconditioner_t const & M, std::vector<float> & x, std::vector<float> & r, std::vector<float> & z, solver_workspace & ws){
+    residual_update<acc_t> ret = update_CG_iterate(alpha, p, mul_res, x, r, ws);
+    M.apply(r, z);
+    ret.cross_norm = parallel_dot_prod(r, z, reduction_storage<acc_t>::sums(ws));
+    return ret;
+}
+
+// Same with the Jacobi preconditioner, fused in a single pass
+template<typename acc_t>
+residual_update<acc_t> update_CG_residual(acc_t alpha, std::vector<float> const & p, std::vector<float> const & mul_res, jacobi_preconditioner const & M, std::vector<float> & x, std::vector<float> & r, std::vector<float> & z, solver_workspace & ws){
+    std::vector<float> const & preconditioner = M.inverse_diag;
+    std::uint32_t n = x.size();
+    std::vector<acc_t> & partial_sums = reduction_storage<acc_t>::sums(ws), & partial_sq_norms = reduction_storage<acc_t>::sq_norms(ws);
+    std::vector<float> & partial_steps = ws.partial_steps;
+    partial_sums.resize(vector_block_cnt(n));
+    partial_sq_norms.resize(vector_block_cnt(n));
+    partial_steps.resize(vector_block_cnt(n));
+    #pragma omp parallel for
+    for(std::uint32_t k=0; k<partial_sums.size(); ++k){
+        std::uint32_t begin = k * vector_block_size, end = std::min(n, begin + vector_block_size);
+        float max_step = 0.0f;
+        for(std::uint32_t i=begin; i<end; ++i){
+            x[i] = x[i] + alpha * p[i];
+            r[i] = r[i] - alpha * mul_res[i];
+            z[i] = preconditioner[i] * r[i];
+            max_step = std::max<float>(max_step, std::abs(alpha * p[i]));
         }
-        float beta = new_cross_norm / cross_norm;
-        cross_norm = new_cross_norm;
-        for(uint32_t i=0; i<n; ++i)
-            p[i] = z[i] + beta * p[i];
+        partial_sums[k] = range_dot_prod<acc_t>(r.data() + begin, z.data() + begin, end - begin);
+        partial_sq_norms[k] = range_dot_prod<acc_t>(r.data() + begin, r.data() + begin, end - begin);
+        partial_steps[k] = max_step;
     }
+    residual_update<acc_t> ret;
+    ret.cross_norm = sum_blocks(partial_sums);
+    ret.residual_sq_norm = sum_blocks(partial_sq_norms);
+    ret.max_step = partial_steps.empty() ? 0.0f : *std::max_element(partial_steps.begin(), partial_steps.end());
+    return ret;
+}
 
-    return x;
+// p = z + beta p
+template<typename acc_t>
+void update_CG_direction(acc_t beta, std::vector<float> const & z, std::vector<float> & p){
+    std::uint32_t n = p.size();
+    #pragma omp parallel for schedule(static, vector_block_size)
+    for(std::uint32_t i=0; i<n; ++i){
+        p[i] = z[i] + beta * p[i];
+    }
 }
+} // End anonymous namespace
 
-template<std::uint32_t unroll_len>
-std::vector<float> ellpack_matrix<unroll_len>::solve_CG(std::vector<float> goal, std::vector<float> x, std::uint32_t min_iter, std::uint32_t max_iter, float tol_ratio) const{
-    std::uint32_t n = diag.size();
-    std::uint32_t old_n = x.size();
-    assert(goal.size() == x.size());
-    x.resize(diag.size(), 0.0);
-    goal.resize(diag.size(), 0.0);
+// When to stop the conjugate gradient: after max_iter iterations, or when one of the tolerances is met after min_iter iterations
+// Null tolerances are never met, even by an exact solution
+struct stopping_criteria{
+    std::uint32_t min_iter, max_iter;
+    float relative_tolerance, absolute_tolerance, displacement_tolerance;
+    float cross_norm_tolerance; // On r.M^-1r relative to its initial value, as in the original csr_matrix::solve_CG
 
-    std::vector<float> r, p(n), z(n), mul_res, preconditioner(n);
-    r = mul(x);
-    for(uint32_t i=0; i<n; ++i){
-        r[i] = goal[i] - r[i];
+    stopping_criteria(std::uint32_t min_i, std::uint32_t max_i, float relative_tol) : min_iter(min_i), max_iter(max_i), relative_tolerance(relative_tol), absolute_tolerance(0.0), displacement_tolerance(0.0), cross_norm_tolerance(0.0){}
+    stopping_criteria(std::uint32_t nbr_iter, solver_options const & options) :
+        min_iter(options.min_iterations), max_iter(nbr_iter),
+        relative_tolerance(options.relative_tolerance), absolute_tolerance(options.absolute_tolerance), displacement_tolerance(options.displacement_tolerance), cross_norm_tolerance(0.0){}
+
+    bool is_met(std::uint32_t iter, float residual_norm, float goal_norm, float max_step) const{
+        return iter >= min_iter and (
+               (relative_tolerance > 0.0f and residual_norm <= relative_tolerance * goal_norm)
+            or (absolute_tolerance > 0.0f and residual_norm <= absolute_tolerance)
+            or (displacement_tolerance > 0.0f and max_step <= displacement_tolerance)
+        );
+    }
+    template<typename acc_t>
+    bool is_met(std::uint32_t iter, float residual_norm, float goal_norm, float max_step, acc_t cross_norm, acc_t start_cross_norm) const{
+        return is_met(iter, residual_norm, goal_norm, max_step)
+            or (iter >= min_iter and cross_norm_tolerance > 0.0f and cross_norm <= cross_norm_tolerance * start_cross_norm);
+    }
+};
+
+/*
+ * The coefficients of the conjugate gradient, which give the tridiagonal matrix of the Lanczos process on the preconditioned system
+ *
+ * Its extreme eigenvalues converge quickly to those of M^-1 A, from the inside of the spectrum.
+ */
+struct lanczos_coefficients{
+    std::vector<float> alphas, betas;
+
+    // False if no estimate is available
+    bool extreme_eigenvalues(float & lower, float & upper) const;
+};
+
+bool lanczos_coefficients::extreme_eigenvalues(float & lower, float & upper) const{
+    std::uint32_t m = alphas.size();
+    if(m == 0 or betas.size() + 1 < m) return false;
+    std::vector<double> diag(m), off_sq(m, 0.0);
+    for(std::uint32_t j=0; j<m; ++j){
+        diag[j] = 1.0 / alphas[j] + (j > 0 ? betas[j-1] / alphas[j-1] : 0.0);
+        if(j+1 < m) off_sq[j] = betas[j] / (static_cast<double>(alphas[j]) * alphas[j]);
+    }
+    // Number of eigenvalues below a value, from the signs of the Sturm sequence
+    auto count_below = [&](double v) -> std::uint32_t{
+        std::uint32_t cnt = 0;
+        double q = 1.0;
+        for(std::uint32_t j=0; j<m; ++j){
+            q = diag[j] - v - (j > 0 ? off_sq[j-1] / q : 0.0);
+            if(q == 0.0) q = -1.0e-300;
+            if(q < 0.0) ++cnt;
+        }
+        return cnt;
+    };
+    double low = std::numeric_limits<double>::max(), high = -std::numeric_limits<double>::max();
+    for(std::uint32_t j=0; j<m; ++j){
+        double radius = (j > 0 ? std::sqrt(off_sq[j-1]) : 0.0) + std::sqrt(off_sq[j]);
+        low = std::min(low, diag[j] - radius);
+        high = std::max(high, diag[j] + radius);
+    }
+    // Bisection on the smallest and largest eigenvalues
+    double bounds[2];
+    for(std::uint32_t e=0; e<2; ++e){
+        double a = low, b = high;
+        for(int it=0; it<100; ++it){
+            double mid = 0.5 * (a + b);
+            bool below = e == 0 ? count_below(mid) >= 1 : count_below(mid) >= m;
+            if(below) b = mid;
+            else      a = mid;
+        }
+        bounds[e] = 0.5 * (a + b);
+    }
+    lower = bounds[0];
+    upper = bounds[1];
+    return std::isfinite(lower) and std::isfinite(upper) and lower > 0.0f and upper > lower;
+}
+
+// Preconditioned conjugate gradient in place, for any matrix providing a product and any preconditioner providing z = M^-1 r
+// The reductions and the coefficients are computed in the precision acc_t; the coefficients are recorded if requested
+template<typename acc_t = float, typename matrix_t, typename preconditioner_t>
+void solve_preconditioned_CG(matrix_t const & A, preconditioner_t const & M, std::vector<float> const & goal, std::vector<float> & x, stopping_criteria const & criteria, solver_report & report, solver_workspace & ws, lanczos_coefficients * coefs = nullptr){
+    std::uint32_t n = goal.size();
+    assert(x.size() == n);
+    std::vector<float> & r = ws.residual, & p = ws.direction, & z = ws.preconditioned, & mul_res = ws.product;
+    z.resize(n);
+    A.mul(x, r);
+    #pragma omp parallel for schedule(static, vector_block_size)
+    for(uint32_t i=0; i<n; ++i){
+        r[i] = goal[i] - r[i];
+    }
+    M.apply(r, z);
+    p = z;
+
+    std::vector<acc_t> & partial_sums = reduction_storage<acc_t>::sums(ws);
+    acc_t cross_norm = parallel_dot_prod(r, z, partial_sums);
+    assert(std::isfinite(cross_norm));
+    acc_t const epsilon = std::numeric_limits<acc_t>::min();
+    acc_t const start_cross_norm = cross_norm;
+
+    float goal_norm = std::sqrt(parallel_dot_prod(goal, goal, partial_sums));
+    report.iterations = 0;
+    report.residual = std::sqrt(parallel_dot_prod(r, r, partial_sums));
+    for(uint32_t k=0; k < criteria.max_iter; ++k){
+        A.mul(p, mul_res);
+
+        acc_t pr_prod = parallel_dot_prod(p, mul_res, partial_sums);
+        acc_t alpha = cross_norm / pr_prod;
+
+        if(
+            not std::isfinite(cross_norm) or not std::isfinite(alpha) or not std::isfinite(pr_prod)
+            or cross_norm <= epsilon or alpha <= epsilon or pr_prod <= epsilon
+            ){
+            break;
+        }
+        if(coefs != nullptr) coefs->alphas.push_back(alpha);
+
+        // Update the result
+        residual_update<acc_t> update = update_CG_residual(alpha, p, mul_res, M, x, r, z, ws);
+        acc_t new_cross_norm = update.cross_norm;
+        report.iterations = k+1;
+        report.residual = std::sqrt(update.residual_sq_norm);
+
+        // Update the scaled residual and the search direction
+        if(criteria.is_met(k+1, report.residual, goal_norm, update.max_step, new_cross_norm, start_cross_norm)){
+            break;
+        }
+        acc_t beta = new_cross_norm / cross_norm;
+        if(coefs != nullptr) coefs->betas.push_back(beta);
+        cross_norm = new_cross_norm;
+        update_CG_direction(beta, z, p);
+    }
+
+    report.relative_residual = goal_norm > 0.0f ? report.residual / goal_norm : 0.0f;
+}
+
+// Conjugate gradient with a Jacobi preconditioner, for any matrix providing a product and its diagonal
+template<typename matrix_t>
+void solve_jacobi_CG(matrix_t const & A, std::vector<float> const & diag, std::vector<float> const & goal, std::vector<float> & x, stopping_criteria const & criteria, solver_report & report, solver_workspace & ws){
+    assert(diag.size() == goal.size());
+    solve_preconditioned_CG(A, jacobi_preconditioner(diag, ws.inverse_diag), goal, x, criteria, report, ws);
+}
+
+std::vector<float> csr_matrix::solve_CG(std::vector<float> const & goal, std::vector<float> x, std::uint32_t min_iter, std::uint32_t max_iter, float tol_ratio) const{
+    solver_workspace ws;
+    solver_report report;
+    // tol_ratio applies to r.M^-1r relative to its initial value, checked after more than min_iter iterations
+    stopping_criteria criteria(min_iter + 1, max_iter, 0.0f);
+    criteria.cross_norm_tolerance = tol_ratio;
+    solve_jacobi_CG(*this, diag, goal, x, criteria, report, ws);
+    return x;
+}
+
+namespace{
+// The reductions of the pipelined conjugate gradient, computed in a single pass
+struct pipelined_update{
+    float gamma;            // r.u
+    float delta;            // w.u
+    float residual_sq_norm; // r.r
+    float max_step;         // Largest change of a variable
+};
+
+// Update the directions and the iterates of the pipelined conjugate gradient, and compute the reductions of the next iteration in the same pass
+pipelined_update update_pipelined_CG(float alpha, float beta, std::vector<float> const & n_vec, std::vector<float> const & m, solver_workspace & ws, std::vector<float> & x){
+    std::vector<float> & r = ws.residual, & u = ws.preconditioned, & p = ws.direction;
+    std::vector<float> & w = ws.pipeline_w, & z = ws.pipeline_z, & q = ws.pipeline_q, & s = ws.pipeline_s;
+    std::uint32_t n = x.size();
+    std::vector<float> & partial_gammas = ws.partial_sums, & partial_deltas = ws.partial_curvatures, & partial_sq_norms = ws.partial_sq_norms, & partial_steps = ws.partial_steps;
+    std::uint32_t block_cnt = vector_block_cnt(n);
+    partial_gammas.resize(block_cnt);
+    partial_deltas.resize(block_cnt);
+    partial_sq_norms.resize(block_cnt);
+    partial_steps.resize(block_cnt);
+    #pragma omp parallel for
+    for(std::uint32_t k=0; k<block_cnt; ++k){
+        std::uint32_t begin = k * vector_block_size, end = std::min(n, begin + vector_block_size);
+        float max_step = 0.0f;
+        for(std::uint32_t i=begin; i<end; ++i){
+            z[i] = n_vec[i] + beta * z[i];
+            q[i] = m[i] + beta * q[i];
+            s[i] = w[i] + beta * s[i];
+            p[i] = u[i] + beta * p[i];
+            x[i] = x[i] + alpha * p[i];
+            r[i] = r[i] - alpha * s[i];
+            u[i] = u[i] - alpha * q[i];
+            w[i] = w[i] - alpha * z[i];
+            max_step = std::max(max_step, std::abs(alpha * p[i]));
+        }
+        partial_gammas[k] = range_dot_prod(r.data() + begin, u.data() + begin, end - begin);
+        partial_deltas[k] = range_dot_prod(w.data() + begin, u.data() + begin, end - begin);
+        partial_sq_norms[k] = range_dot_prod(r.data() + begin, r.data() + begin, end - begin);
+        partial_steps[k] = max_step;
+    }
+    pipelined_update ret;
+    ret.gamma = sum_blocks(partial_gammas);
+    ret.delta = sum_blocks(partial_deltas);
+    ret.residual_sq_norm = sum_blocks(partial_sq_norms);
+    ret.max_step = partial_steps.empty() ? 0.0f : *std::max_element(partial_steps.begin(), partial_steps.end());
+    return ret;
+}
+} // End anonymous namespace
+
+/*
+ * Pipelined preconditioned conjugate gradient (Ghysels and Vanroose, 2014)
+ *
+ * The recurrences are rewritten so that the products r.u and w.u of an iteration only depend on vectors updated in the previous one:
+ * they are computed in the same pass as the updates, and there is a single reduction per iteration instead of two.
+ * The additional recurrences accumulate more rounding errors, and in single precision the recursive residual quickly drifts from the true one.
+ * The vectors are recomputed from their definitions periodically and before stopping (residual replacement).
+ * On a breakdown or a large growth of the residual, the remaining iterations are done with the classical conjugate gradient from the current solution.
+ */
+template<typename matrix_t, typename preconditioner_t>
+void solve_pipelined_CG(matrix_t const & A, preconditioner_t const & M, std::vector<float> const & goal, std::vector<float> & x, stopping_criteria const & criteria, solver_report & report, solver_workspace & ws){
+    // Iterations between two residual replacements
+    std::uint32_t const replacement_period = 32;
+    // Growth of the residual norm over the smallest one seen that triggers the fallback
+    float const max_residual_growth = 1.0e3f;
+
+    std::uint32_t n = goal.size();
+    assert(x.size() == n);
+    std::vector<float> & r = ws.residual, & u = ws.preconditioned, & p = ws.direction, & n_vec = ws.product;
+    std::vector<float> & w = ws.pipeline_w, & m = ws.pipeline_m, & z = ws.pipeline_z, & q = ws.pipeline_q, & s = ws.pipeline_s;
+    u.resize(n);
+    m.resize(n);
+    q.resize(n);
+    // The directions start at zero, so that the first update sets them
+    p.assign(n, 0.0f);
+    z.assign(n, 0.0f);
+    q.assign(n, 0.0f);
+    s.assign(n, 0.0f);
+
+    float gamma, delta;
+    // Recompute r = b - Ax, u = M r, w = A u, s = A p, q = M s, z = A q and the products; returns the residual norm
+    auto replace_residual = [&]() -> float{
+        A.mul(x, r);
+        #pragma omp parallel for schedule(static, vector_block_size)
+        for(uint32_t i=0; i<n; ++i){
+            r[i] = goal[i] - r[i];
+        }
+        M.apply(r, u);
+        A.mul(u, w);
+        M.apply(w, m);
+        A.mul(p, s);
+        M.apply(s, q);
+        A.mul(q, z);
+        gamma = parallel_dot_prod(r, u, ws.partial_sums);
+        delta = parallel_dot_prod(w, u, ws.partial_sums);
+        return std::sqrt(parallel_dot_prod(r, r, ws.partial_sums));
+    };
+
+    float goal_norm = std::sqrt(parallel_dot_prod(goal, goal, ws.partial_sums));
+    report.iterations = 0;
+    report.residual = replace_residual();
+    float_t const epsilon = std::numeric_limits<float_t>::min();
+
+    float prev_gamma = 0.0f, alpha = 0.0f;
+    float min_residual = report.residual;
+    bool unstable = false;
+    uint32_t k = 0;
+    for(; k < criteria.max_iter; ++k){
+        A.mul(m, n_vec);
+
+        float beta = k > 0 ? gamma / prev_gamma : 0.0f;
+        float denominator = k > 0 ? delta - beta * gamma / alpha : delta;
+        if(not std::isfinite(gamma) or gamma <= epsilon){
+            break;
+        }
+        if(not std::isfinite(beta) or not std::isfinite(denominator) or denominator <= epsilon){
+            unstable = true;
+            break;
+        }
+        alpha = gamma / denominator;
+        if(not std::isfinite(alpha) or alpha <= epsilon){
+            unstable = true;
+            break;
+        }
+
+        pipelined_update update = update_pipelined_CG(alpha, beta, n_vec, m, ws, x);
+        report.iterations = k+1;
+        report.residual = std::sqrt(update.residual_sq_norm);
+        prev_gamma = gamma;
+        gamma = update.gamma;
+        delta = update.delta;
+
+        // Only stop on the true residual
+        bool converged = criteria.is_met(k+1, report.residual, goal_norm, update.max_step);
+        if(converged or (k+1) % replacement_period == 0){
+            report.residual = replace_residual();
+            if(criteria.is_met(k+1, report.residual, goal_norm, update.max_step)){
+                break;
+            }
+        }
+        else{
+            M.apply(w, m);
+        }
+
+        if(not std::isfinite(report.residual) or report.residual > max_residual_growth * min_residual){
+            unstable = true;
+            ++k;
+            break;
+        }
+        min_residual = std::min(min_residual, report.residual);
+    }
+
+    if(unstable and k < criteria.max_iter){
+        stopping_criteria remaining = criteria;
+        remaining.min_iter = criteria.min_iter > k ? criteria.min_iter - k : 0;
+        remaining.max_iter = criteria.max_iter - k;
+        solver_report classical;
+        solve_preconditioned_CG(A, M, goal, x, remaining, classical, ws);
+        report.iterations = k + classical.iterations;
+        report.residual = classical.residual;
+    }
+    report.relative_residual = goal_norm > 0.0f ? report.residual / goal_norm : 0.0f;
+}
+
+/*
+ * Preconditioned Chebyshev iteration
+ *
+ * With the eigenvalues of M^-1 A in [lower, upper], the error is multiplied at each iteration by the shifted Chebyshev polynomial of the interval:
+ * no inner product is needed, and each iteration is a product, an application of the preconditioner and a fused vector update.
+ * The bounds are estimated by the first iterations, done with the conjugate gradient.
+ * The Lanczos estimate of the largest eigenvalue is from below: it is enlarged by a margin, within the Gershgorin bound when one is known.
+ * The estimate of the smallest eigenvalue is from above, which only slows the convergence of the lowest modes without making them diverge.
+ * The residual is only computed every check_period iterations, to test the tolerances and stop when it vanishes.
+ */
+template<typename matrix_t, typename preconditioner_t>
+void solve_chebyshev(matrix_t const & A, preconditioner_t const & M, std::vector<float> const & goal, std::vector<float> & x, stopping_criteria const & criteria,
+        std::uint32_t lanczos_steps, std::uint32_t check_period, float spectral_bound, solver_report & report, solver_workspace & ws){
+    float const upper_margin = 1.1f;
+    float const epsilon = std::numeric_limits<float>::min();
+
+    // Estimation of the bounds
+    stopping_criteria initial = criteria;
+    initial.max_iter = std::min(criteria.max_iter, std::max<std::uint32_t>(lanczos_steps, 2));
+    lanczos_coefficients coefs;
+    solve_preconditioned_CG(A, M, goal, x, initial, report, ws, &coefs);
+    std::uint32_t done = report.iterations;
+    float goal_norm = report.relative_residual > 0.0f ? report.residual / report.relative_residual : std::sqrt(parallel_dot_prod(goal, goal, ws.partial_sums));
+    if(done < initial.max_iter or done >= criteria.max_iter) return; // Converged, broke down or no iteration left
+
+    float lower, upper;
+    stopping_criteria remaining = criteria;
+    remaining.min_iter = criteria.min_iter > done ? criteria.min_iter - done : 0;
+    remaining.max_iter = criteria.max_iter - done;
+    if(not coefs.extreme_eigenvalues(lower, upper)){
+        // Continue with the conjugate gradient
+        solver_report rest;
+        solve_preconditioned_CG(A, M, goal, x, remaining, rest, ws);
+        report.iterations = done + rest.iterations;
+        report.residual = rest.residual;
+        report.relative_residual = rest.relative_residual;
+        return;
+    }
+    upper *= upper_margin;
+    if(spectral_bound > 0.0f) upper = std::min(upper, spectral_bound);
+
+    std::uint32_t n = goal.size();
+    std::vector<float> & r = ws.residual, & z = ws.preconditioned, & d = ws.direction, & mul_res = ws.product;
+    float theta = 0.5f * (upper + lower), half_width = 0.5f * (upper - lower);
+    float sigma = theta / half_width;
+    float rho = 1.0f / sigma;
+
+    // The residual of the conjugate gradient is up to date; its last preconditioned residual is not needed
+    M.apply(r, z);
+    #pragma omp parallel for schedule(static, vector_block_size)
+    for(std::uint32_t i=0; i<n; ++i){
+        d[i] = z[i] / theta;
+    }
+
+    std::uint32_t k = 0;
+    for(; k < remaining.max_iter; ++k){
+        A.mul(d, mul_res);
+        bool check = (k+1) % check_period == 0;
+        float max_step = 0.0f;
+        #pragma omp parallel for schedule(static, vector_block_size) reduction(max:max_step)
+        for(std::uint32_t i=0; i<n; ++i){
+            x[i] += d[i];
+            r[i] -= mul_res[i];
+            max_step = std::max(max_step, std::abs(d[i]));
+        }
+        if(check){
+            float sq_residual = parallel_dot_prod(r, r, ws.partial_sums);
+            if(sq_residual <= epsilon or remaining.is_met(k+1, std::sqrt(sq_residual), goal_norm, max_step)){
+                ++k;
+                break;
+            }
+        }
+        M.apply(r, z);
+        float new_rho = 1.0f / (2.0f * sigma - rho);
+        float d_scale = new_rho * rho, z_scale = 2.0f * new_rho / half_width;
+        #pragma omp parallel for schedule(static, vector_block_size)
+        for(std::uint32_t i=0; i<n; ++i){
+            d[i] = d_scale * d[i] + z_scale * z[i];
+        }
+        rho = new_rho;
+    }
+    report.iterations = done + k;
+    report.residual = std::sqrt(parallel_dot_prod(r, r, ws.partial_sums));
+    report.relative_residual = goal_norm > 0.0f ? report.residual / goal_norm : 0.0f;
+}
+
+namespace{
+// The products of two lists of vectors, res[a*V.size()+b] = U[a].V[b], or U[a].D.V[b] with a diagonal scaling; accumulated in double with the same blocks as parallel_dot_prod
+void list_products(std::vector<std::vector<float> const *> const & U, std::vector<std::vector<float> const *> const & V, std::vector<float> const * scaling, std::vector<double> & res, std::vector<double> & partial_sums){
+    std::uint32_t su = U.size(), sv = V.size(), cnt = su * sv;
+    res.assign(cnt, 0.0);
+    if(cnt == 0) return;
+    std::uint32_t n = U[0]->size();
+    partial_sums.resize(vector_block_cnt(n) * cnt);
+    #pragma omp parallel for
+    for(std::uint32_t k=0; k<vector_block_cnt(n); ++k){
+        std::uint32_t begin = k * vector_block_size, end = std::min(n, begin + vector_block_size);
+        double * sums = partial_sums.data() + k * cnt;
+        for(std::uint32_t a=0; a<su; ++a){
+            float const * u = U[a]->data();
+            for(std::uint32_t b=0; b<sv; ++b){
+                float const * v = V[b]->data();
+                double sum = 0.0;
+                if(scaling != nullptr){
+                    float const * d = scaling->data();
+                    for(std::uint32_t i=begin; i<end; ++i) sum += static_cast<double>(u[i]) * d[i] * v[i];
+                }
+                else{
+                    for(std::uint32_t i=begin; i<end; ++i) sum += static_cast<double>(u[i]) * v[i];
+                }
+                sums[a * sv + b] = sum;
+            }
+        }
+    }
+    for(std::uint32_t k=0; k<vector_block_cnt(n); ++k){
+        for(std::uint32_t c=0; c<cnt; ++c){
+            res[c] += partial_sums[k * cnt + c];
+        }
+    }
+}
+
+// x += sign * sum_a coefs[a] U[a]
+void add_combination(std::vector<std::vector<float> const *> const & U, std::vector<double> const & coefs, float sign, std::vector<float> & x){
+    std::uint32_t n = x.size();
+    #pragma omp parallel for schedule(static, vector_block_size)
+    for(std::uint32_t i=0; i<n; ++i){
+        double sum = 0.0;
+        for(std::uint32_t a=0; a<U.size(); ++a) sum += coefs[a] * (*U[a])[i];
+        x[i] += sign * static_cast<float>(sum);
+    }
+}
+
+// In-place Cholesky factorization of a small dense matrix (lower triangle); false if it is not positive definite
+bool dense_cholesky(std::vector<double> & a, std::uint32_t s){
+    for(std::uint32_t j=0; j<s; ++j){
+        double d = a[j*s+j];
+        for(std::uint32_t k=0; k<j; ++k) d -= a[j*s+k] * a[j*s+k];
+        if(not (d > 0.0)) return false;
+        a[j*s+j] = std::sqrt(d);
+        for(std::uint32_t i=j+1; i<s; ++i){
+            double v = a[i*s+j];
+            for(std::uint32_t k=0; k<j; ++k) v -= a[i*s+k] * a[j*s+k];
+            a[i*s+j] = v / a[j*s+j];
+        }
+    }
+    return true;
+}
+
+void dense_cholesky_solve(std::vector<double> const & l, std::uint32_t s, std::vector<double> & b){
+    for(std::uint32_t i=0; i<s; ++i){
+        for(std::uint32_t k=0; k<i; ++k) b[i] -= l[i*s+k] * b[k];
+        b[i] /= l[i*s+i];
+    }
+    for(std::uint32_t i=s; i-- > 0;){
+        for(std::uint32_t k=i+1; k<s; ++k) b[i] -= l[k*s+i] * b[k];
+        b[i] /= l[i*s+i];
+    }
+}
+
+// Eigenvalues and eigenvectors (columns of vectors) of a small dense symmetric matrix, by cyclic Jacobi rotations
+void dense_symmetric_eigen(std::vector<double> a, std::uint32_t s, std::vector<double> & values, std::vector<double> & vectors){
+    vectors.assign(s*s, 0.0);
+    for(std::uint32_t i=0; i<s; ++i) vectors[i*s+i] = 1.0;
+    for(int sweep=0; sweep<64; ++sweep){
+        double off = 0.0, total = 0.0;
+        for(std::uint32_t i=0; i<s; ++i){
+            for(std::uint32_t j=0; j<s; ++j){
+                total += a[i*s+j] * a[i*s+j];
+                if(i != j) off += a[i*s+j] * a[i*s+j];
+            }
+        }
+        if(off <= 1.0e-24 * total) break;
+        for(std::uint32_t p=0; p<s; ++p){
+            for(std::uint32_t q=p+1; q<s; ++q){
+                double apq = a[p*s+q];
+                if(apq == 0.0) continue;
+                double theta = (a[q*s+q] - a[p*s+p]) / (2.0 * apq);
+                double t = (theta >= 0.0 ? 1.0 : -1.0) / (std::abs(theta) + std::sqrt(theta * theta + 1.0));
+                double c = 1.0 / std::sqrt(t * t + 1.0), sn = t * c;
+                for(std::uint32_t k=0; k<s; ++k){
+                    double akp = a[k*s+p], akq = a[k*s+q];
+                    a[k*s+p] = c * akp - sn * akq;
+                    a[k*s+q] = sn * akp + c * akq;
+                }
+                for(std::uint32_t k=0; k<s; ++k){
+                    double apk = a[p*s+k], aqk = a[q*s+k];
+                    a[p*s+k] = c * apk - sn * aqk;
+                    a[q*s+k] = sn * apk + c * aqk;
+                }
+                for(std::uint32_t k=0; k<s; ++k){
+                    double vkp = vectors[k*s+p], vkq = vectors[k*s+q];
+                    vectors[k*s+p] = c * vkp - sn * vkq;
+                    vectors[k*s+q] = sn * vkp + c * vkq;
+                }
+            }
+        }
+    }
+    values.resize(s);
+    for(std::uint32_t i=0; i<s; ++i) values[i] = a[i*s+i];
+}
+} // End anonymous namespace
+
+/*
+ * Deflated preconditioned conjugate gradient (Saad, Yeung, Erhel and Guyomarc'h), recycling its deflation vectors from one solve to the next
+ *
+ * The workspace keeps a basis W approximating the eigenvectors of the smallest eigenvalues of M^-1 A, found during the previous solves.
+ * The initial residual is made orthogonal to W, and the directions A-orthogonal to it: the conjugate gradient only works on the rest of the spectrum.
+ * This costs a projection on W and its products at each iteration, but the smallest eigenvalues are those that slow the convergence the most.
+ * The next basis is the Rayleigh-Ritz approximation in the span of W and of the first directions of this solve, which are A-orthogonal to each other and to W.
+ * Since the matrix changes little between successive solves, the basis improves from one solve to the next; any basis gives a correct solve.
+ * The basis follows the original variables when the variables of the solver change, with zeros for the new ones.
+ */
+template<typename matrix_t, typename preconditioner_t>
+void solve_deflated_CG(matrix_t const & A, preconditioner_t const & M, std::vector<float> const & diag, std::vector<float> const & goal, std::vector<float> & x, stopping_criteria const & criteria,
+        std::uint32_t deflation_cnt, solver_report & report, solver_workspace & ws){
+    std::uint32_t n = goal.size();
+    std::vector<std::vector<float> > & basis = ws.deflation_basis, & products = ws.deflation_products, & directions = ws.recycled_directions;
+    std::vector<float> & r = ws.residual, & p = ws.direction, & z = ws.preconditioned, & mul_res = ws.product;
+    std::vector<double> & partial_sums = ws.accurate_sums;
+    std::vector<std::uint32_t> const & indexes = ws.solver_indexes;
+    std::vector<std::uint32_t> & basis_indexes = ws.deflation_indexes;
+    if(not basis.empty() and indexes.size() == n and basis_indexes.size() == basis[0].size() and basis_indexes != indexes){
+        // Renumber the basis from the variables of the previous solve
+        std::uint32_t const null_ind = std::numeric_limits<std::uint32_t>::max();
+        std::uint32_t index_cnt = 1 + std::max(*std::max_element(indexes.begin(), indexes.end()), *std::max_element(basis_indexes.begin(), basis_indexes.end()));
+        std::vector<std::uint32_t> positions(index_cnt, null_ind);
+        for(std::uint32_t i=0; i<n; ++i) positions[indexes[i]] = i;
+        products.resize(basis.size());
+        for(std::uint32_t j=0; j<basis.size(); ++j){
+            products[j].assign(n, 0.0f);
+            for(std::uint32_t e=0; e<basis_indexes.size(); ++e){
+                std::uint32_t pos = positions[basis_indexes[e]];
+                if(pos != null_ind) products[j][pos] = basis[j][e];
+            }
+        }
+        std::swap(basis, products);
+    }
+    if(basis.size() > deflation_cnt or (not basis.empty() and basis[0].size() != n)) basis.clear();
+
+    // The products of the basis, and the Cholesky factorization of E = W^T A W; the basis is dropped if E is singular
+    std::vector<std::vector<float> const *> W, AW, single(1);
+    std::vector<double> E, coefs;
+    products.resize(basis.size());
+    for(std::uint32_t j=0; j<basis.size(); ++j){
+        A.mul(basis[j], products[j]);
+        W.push_back(&basis[j]);
+        AW.push_back(&products[j]);
+    }
+    list_products(W, AW, nullptr, E, partial_sums);
+    if(not dense_cholesky(E, W.size())){
+        basis.clear();
+        W.clear();
+        AW.clear();
+    }
+    std::uint32_t k = W.size();
+    // Remove the components of W from a vector v: v -= W E^-1 (U^T v)
+    auto project = [&](std::vector<std::vector<float> const *> const & U, std::vector<float> const & v, std::vector<double> & c){
+        single[0] = &v;
+        list_products(U, single, nullptr, c, partial_sums);
+        dense_cholesky_solve(E, k, c);
+    };
+
+    // Initial guess with a residual orthogonal to W
+    A.mul(x, r);
+    #pragma omp parallel for schedule(static, vector_block_size)
+    for(std::uint32_t i=0; i<n; ++i){
+        r[i] = goal[i] - r[i];
+    }
+    if(k > 0){
+        project(W, r, coefs);
+        add_combination(W, coefs, 1.0f, x);
+        add_combination(AW, coefs, -1.0f, r);
+    }
+    z.resize(n);
+    M.apply(r, z);
+    p = z;
+    if(k > 0){
+        project(AW, z, coefs);
+        add_combination(W, coefs, -1.0f, p);
+    }
+
+    float cross_norm = parallel_dot_prod(r, z, ws.partial_sums);
+    float const epsilon = std::numeric_limits<float>::min();
+    float goal_norm = std::sqrt(parallel_dot_prod(goal, goal, ws.partial_sums));
+    report.iterations = 0;
+    report.residual = std::sqrt(parallel_dot_prod(r, r, ws.partial_sums));
+    // Twice as many directions as basis vectors are kept for the next basis
+    std::vector<double> curvatures;
+    std::uint32_t direction_cnt = 0;
+    directions.resize(2 * deflation_cnt);
+    for(std::uint32_t it=0; it < criteria.max_iter; ++it){
+        A.mul(p, mul_res);
+        float pr_prod = parallel_dot_prod(p, mul_res, ws.partial_sums);
+        float alpha = cross_norm / pr_prod;
+        if(
+            not std::isfinite(cross_norm) or not std::isfinite(alpha) or not std::isfinite(pr_prod)
+            or cross_norm <= epsilon or alpha <= epsilon or pr_prod <= epsilon
+            ){
+            break;
+        }
+        if(direction_cnt < 2 * deflation_cnt){
+            directions[direction_cnt++] = p;
+            curvatures.push_back(pr_prod);
+        }
+
+        residual_update<float> update = update_CG_residual(alpha, p, mul_res, M, x, r, z, ws);
+        report.iterations = it+1;
+        report.residual = std::sqrt(update.residual_sq_norm);
+        if(criteria.is_met(it+1, report.residual, goal_norm, update.max_step)){
+            break;
+        }
+        float beta = update.cross_norm / cross_norm;
+        cross_norm = update.cross_norm;
+        update_CG_direction(beta, z, p);
+        if(k > 0){
+            project(AW, z, coefs);
+            add_combination(W, coefs, -1.0f, p);
+        }
+    }
+    report.relative_residual = goal_norm > 0.0f ? report.residual / goal_norm : 0.0f;
+
+    // Rayleigh-Ritz on Z = [W, P] for A w = theta D w, with Z^T A Z block diagonal by construction
+    std::vector<std::vector<float> const *> Z = W;
+    for(std::uint32_t j=0; j<direction_cnt; ++j) Z.push_back(&directions[j]);
+    std::uint32_t s = Z.size();
+    if(s == 0) return;
+    std::vector<double> F, G(s*s, 0.0);
+    list_products(Z, Z, &diag, F, partial_sums);
+    // Recover W^T A W from its factor
+    for(std::uint32_t i=0; i<k; ++i){
+        for(std::uint32_t j=0; j<k; ++j){
+            double v = 0.0;
+            for(std::uint32_t l=0; l<=std::min(i, j); ++l) v += E[i*k+l] * E[j*k+l];
+            G[i*s+j] = v;
+        }
+    }
+    for(std::uint32_t j=0; j<direction_cnt; ++j) G[(k+j)*s+k+j] = curvatures[j];
+
+    // Orthonormal basis of the span for the D inner product, dropping the dependent vectors: T = V diag(1/sqrt(lambda))
+    std::vector<double> f_values, f_vectors;
+    dense_symmetric_eigen(F, s, f_values, f_vectors);
+    double max_value = *std::max_element(f_values.begin(), f_values.end());
+    std::vector<std::uint32_t> kept;
+    for(std::uint32_t i=0; i<s; ++i){
+        if(f_values[i] > 1.0e-10 * max_value) kept.push_back(i);
+    }
+    std::uint32_t t = kept.size();
+    std::vector<double> T(s*t);
+    for(std::uint32_t a=0; a<s; ++a){
+        for(std::uint32_t b=0; b<t; ++b){
+            T[a*t+b] = f_vectors[a*s+kept[b]] / std::sqrt(f_values[kept[b]]);
+        }
+    }
+    // C = T^T G T, whose smallest eigenvectors give the new basis Z T u
+    std::vector<double> C(t*t, 0.0);
+    for(std::uint32_t a=0; a<t; ++a){
+        for(std::uint32_t b=0; b<t; ++b){
+            double v = 0.0;
+            for(std::uint32_t i=0; i<s; ++i){
+                for(std::uint32_t j=0; j<s; ++j){
+                    v += T[i*t+a] * G[i*s+j] * T[j*t+b];
+                }
+            }
+            C[a*t+b] = v;
+        }
+    }
+    std::vector<double> c_values, c_vectors;
+    dense_symmetric_eigen(C, t, c_values, c_vectors);
+    std::vector<std::uint32_t> ritz_order(t);
+    std::iota(ritz_order.begin(), ritz_order.end(), 0);
+    std::sort(ritz_order.begin(), ritz_order.end(), [&](std::uint32_t a, std::uint32_t b){ return c_values[a] < c_values[b]; });
+
+    // The products are not needed anymore: their storage receives the new basis
+    std::uint32_t new_cnt = std::min(deflation_cnt, t);
+    products.resize(new_cnt);
+    for(std::uint32_t e=0; e<new_cnt; ++e){
+        std::vector<double> combination(s, 0.0);
+        for(std::uint32_t i=0; i<s; ++i){
+            for(std::uint32_t b=0; b<t; ++b){
+                combination[i] += T[i*t+b] * c_vectors[b*t+ritz_order[e]];
+            }
+        }
+        products[e].assign(n, 0.0f);
+        add_combination(Z, combination, 1.0f, products[e]);
+    }
+    std::swap(basis, products);
+    basis_indexes = indexes;
+}
+
+// Solve with the method of the options; the spectral bound of M^-1 A is used by the Chebyshev iteration if known, and is 0 otherwise
+template<typename matrix_t, typename preconditioner_t>
+void solve_with_method(matrix_t const & A, preconditioner_t const & M, csr_matrix const & mat, std::vector<float> const & goal, std::vector<float> & x, stopping_criteria const & criteria, solver_options const & options, float spectral_bound, solver_report & report, solver_workspace & ws){
+    if(options.solver == PipelinedCGSolver){
+        solve_pipelined_CG(A, M, goal, x, criteria, report, ws);
+    }
+    else if(options.solver == ChebyshevSolver){
+        solve_chebyshev(A, M, goal, x, criteria, options.chebyshev_lanczos_steps, std::max<index_t>(options.chebyshev_check_period, 1), spectral_bound, report, ws);
+    }
+    else if(options.deflation_vectors > 0){
+        solve_deflated_CG(A, M, mat.diag, goal, x, criteria, options.deflation_vectors, report, ws);
+    }
+    else if(options.mixed_precision){
+        solve_preconditioned_CG<double>(A, M, goal, x, criteria, report, ws);
+    }
+    else{
+        solve_preconditioned_CG(A, M, goal, x, criteria, report, ws);
+    }
+}
+
+// r = b - A x with x in double, and the products and the sum of squares accumulated in double; returns r.r
+double accurate_residual(csr_matrix const & A, std::vector<float> const & goal, std::vector<double> const & x, std::vector<float> & r, std::vector<double> & partial_sums){
+    std::uint32_t n = x.size();
+    r.resize(n);
+    partial_sums.resize(vector_block_cnt(n));
+    #pragma omp parallel for
+    for(std::uint32_t k=0; k<partial_sums.size(); ++k){
+        std::uint32_t begin = k * vector_block_size, end = std::min(n, begin + vector_block_size);
+        double sq_norm = 0.0;
+        for(std::uint32_t i=begin; i<end; ++i){
+            double res = goal[i] - A.diag[i] * x[i];
+            for(std::uint32_t j=A.row_limits[i]; j<A.row_limits[i+1]; ++j){
+                res -= A.values[j] * x[A.col_indexes[j]];
+            }
+            r[i] = res;
+            sq_norm += res * res;
+        }
+        partial_sums[k] = sq_norm;
+    }
+    return sum_blocks(partial_sums);
+}
+
+/*
+ * Solve with the method of the options, then refine the solution
+ *
+ * The residual of the float solution loses its accuracy when the coordinates are large compared to the displacements.
+ * Each refinement step computes the residual exactly with the solution in double, and solves for a correction from it with the same preconditioner.
+ * The corrections stop with the tolerances of the options, applied to the residual of the whole system, and share the iteration budget of the first solve.
+ */
+template<typename matrix_t, typename preconditioner_t>
+void solve_refined(matrix_t const & A, preconditioner_t const & M, csr_matrix const & mat, std::vector<float> const & goal, std::vector<float> & x, stopping_criteria const & criteria, solver_options const & options, float spectral_bound, solver_report & report, solver_workspace & ws){
+    solve_with_method(A, M, mat, goal, x, criteria, options, spectral_bound, report, ws);
+    if(options.refinement_steps == 0) return;
+
+    std::uint32_t n = x.size();
+    std::vector<double> & accurate_x = ws.accurate_solution;
+    std::vector<float> & correction = ws.correction, & correction_goal = ws.correction_goal;
+    accurate_x.assign(x.begin(), x.end());
+    float goal_norm = std::sqrt(parallel_dot_prod(goal, goal, ws.accurate_sums));
+    float const no_step = std::numeric_limits<float>::infinity();
+
+    // The correction solves stop once the residual of the whole system meets the tolerances
+    stopping_criteria correction_criteria = criteria;
+    correction_criteria.min_iter = 0;
+    correction_criteria.relative_tolerance = 0.0f;
+    correction_criteria.absolute_tolerance = std::max(criteria.absolute_tolerance, criteria.relative_tolerance * goal_norm);
+
+    float residual = std::sqrt(accurate_residual(mat, goal, accurate_x, correction_goal, ws.accurate_sums));
+    for(std::uint32_t s=0; s<options.refinement_steps and report.iterations < criteria.max_iter and not correction_criteria.is_met(0, residual, goal_norm, no_step); ++s){
+        correction_criteria.max_iter = criteria.max_iter - report.iterations;
+        correction.assign(n, 0.0f);
+        solver_report step;
+        solve_with_method(A, M, mat, correction_goal, correction, correction_criteria, options, spectral_bound, step, ws);
+        if(step.iterations == 0) break;
+        report.iterations += step.iterations;
+        #pragma omp parallel for schedule(static, vector_block_size)
+        for(std::uint32_t i=0; i<n; ++i){
+            accurate_x[i] += correction[i];
+        }
+        residual = std::sqrt(accurate_residual(mat, goal, accurate_x, correction_goal, ws.accurate_sums));
+    }
+    #pragma omp parallel for schedule(static, vector_block_size)
+    for(std::uint32_t i=0; i<n; ++i){
+        x[i] = accurate_x[i];
+    }
+    report.residual = residual;
+    report.relative_residual = goal_norm > 0.0f ? residual / goal_norm : 0.0f;
+}
+
+/*
+ * A triangular matrix whose rows are grouped by levels for the solves
+ *
+ * The rows of a level only depend on rows of the previous levels: they are solved in parallel, level after level.
+ * Small levels are solved by a single thread.
+ */
+struct level_scheduled_triangle{
+    static const std::uint32_t min_parallel_rows = 256;
+
+    // The strict triangle, with sorted columns, and the diagonal
+    std::vector<std::uint32_t> row_limits, col_indexes;
+    std::vector<float> values, diag;
+    std::vector<std::uint32_t> level_limits, level_rows;
+    bool lower;
+
+    level_scheduled_triangle(){}
+    // The strict lower or upper triangle of a matrix
+    level_scheduled_triangle(csr_matrix const & A, bool is_lower);
+    level_scheduled_triangle transpose() const;
+
+    void compute_levels();
+    // x = T^-1 x
+    void solve(std::vector<float> & x) const;
+};
+
+level_scheduled_triangle::level_scheduled_triangle(csr_matrix const & A, bool is_lower) : diag(A.diag), lower(is_lower){
+    std::uint32_t n = diag.size();
+    row_limits.push_back(0);
+    std::vector<std::pair<std::uint32_t, float> > row;
+    for(std::uint32_t i=0; i<n; ++i){
+        row.clear();
+        for(std::uint32_t j=A.row_limits[i]; j<A.row_limits[i+1]; ++j){
+            std::uint32_t c = A.col_indexes[j];
+            if(lower ? c < i : c > i){
+                row.push_back(std::pair<std::uint32_t, float>(c, A.values[j]));
+            }
+        }
+        std::sort(row.begin(), row.end());
+        for(auto const & E : row){
+            col_indexes.push_back(E.first);
+            values.push_back(E.second);
+        }
+        row_limits.push_back(col_indexes.size());
+    }
+    compute_levels();
+}
+
+level_scheduled_triangle level_scheduled_triangle::transpose() const{
+    level_scheduled_triangle ret;
+    std::uint32_t n = diag.size();
+    ret.diag = diag;
+    ret.lower = not lower;
+    ret.row_limits.assign(n+1, 0);
+    ret.col_indexes.resize(col_indexes.size());
+    ret.values.resize(values.size());
+    for(std::uint32_t c : col_indexes){
+        ++ret.row_limits[c+1];
+    }
+    std::partial_sum(ret.row_limits.begin(), ret.row_limits.end(), ret.row_limits.begin());
+    std::vector<std::uint32_t> pos(ret.row_limits.begin(), ret.row_limits.end()-1);
+    // Rows taken in order give sorted columns
+    for(std::uint32_t i=0; i<n; ++i){
+        for(std::uint32_t j=row_limits[i]; j<row_limits[i+1]; ++j){
+            std::uint32_t ind = pos[col_indexes[j]]++;
+            ret.col_indexes[ind] = i;
+            ret.values[ind] = values[j];
+        }
+    }
+    ret.compute_levels();
+    return ret;
+}
+
+void level_scheduled_triangle::compute_levels(){
+    std::uint32_t n = diag.size();
+    std::vector<std::uint32_t> levels(n, 0);
+    std::uint32_t level_cnt = n > 0 ? 1 : 0;
+    // The dependencies are solved first
+    for(std::uint32_t k=0; k<n; ++k){
+        std::uint32_t i = lower ? k : n-1-k;
+        for(std::uint32_t j=row_limits[i]; j<row_limits[i+1]; ++j){
+            levels[i] = std::max(levels[i], levels[col_indexes[j]] + 1);
+        }
+        level_cnt = std::max(level_cnt, levels[i] + 1);
+    }
+    level_limits.assign(level_cnt+1, 0);
+    for(std::uint32_t l : levels){
+        ++level_limits[l+1];
+    }
+    std::partial_sum(level_limits.begin(), level_limits.end(), level_limits.begin());
+    std::vector<std::uint32_t> pos(level_limits.begin(), level_limits.end()-1);
+    level_rows.resize(n);
+    for(std::uint32_t k=0; k<n; ++k){
+        std::uint32_t i = lower ? k : n-1-k;
+        level_rows[pos[levels[i]]++] = i;
+    }
+}
+
+void level_scheduled_triangle::solve(std::vector<float> & x) const{
+    assert(x.size() == diag.size());
+    for(std::uint32_t l=0; l+1<level_limits.size(); ++l){
+        #pragma omp parallel for if(level_limits[l+1] - level_limits[l] >= min_parallel_rows)
+        for(std::uint32_t k=level_limits[l]; k<level_limits[l+1]; ++k){
+            std::uint32_t i = level_rows[k];
+            float cur = x[i];
+            for(std::uint32_t j=row_limits[i]; j<row_limits[i+1]; ++j){
+                cur -= values[j] * x[col_indexes[j]];
+            }
+            x[i] = cur / diag[i];
+        }
+    }
+}
+
+/*
+ * Incomplete Cholesky factorization without fill-in: A ~ L L^T, with L restricted to the lower triangle of A
+ *
+ * The rows of L are computed level by level like the forward solve, since they depend on the same rows.
+ * A non-positive pivot is replaced by the diagonal of A, so that the preconditioner stays positive definite.
+ */
+struct incomplete_cholesky_preconditioner{
+    level_scheduled_triangle lower, upper;
+
+    incomplete_cholesky_preconditioner(csr_matrix const & A);
+    void apply(std::vector<float> const & r, std::vector<float> & z) const{
+        z = r;
+        lower.solve(z);
+        upper.solve(z);
+    }
+};
+
+level_scheduled_triangle factorize_incomplete_cholesky(csr_matrix const & A){
+    level_scheduled_triangle L(A, true);
+    for(std::uint32_t l=0; l+1<L.level_limits.size(); ++l){
+        #pragma omp parallel for if(L.level_limits[l+1] - L.level_limits[l] >= level_scheduled_triangle::min_parallel_rows)
+        for(std::uint32_t k=L.level_limits[l]; k<L.level_limits[l+1]; ++k){
+            std::uint32_t i = L.level_rows[k];
+            float pivot = A.diag[i];
+            for(std::uint32_t j=L.row_limits[i]; j<L.row_limits[i+1]; ++j){
+                // L_ik = (A_ik - sum_{m<k} L_im L_km) / L_kk, with the sparse rows merged
+                std::uint32_t c = L.col_indexes[j];
+                float val = L.values[j];
+                std::uint32_t a = L.row_limits[i], b = L.row_limits[c];
+                while(a < j and b < L.row_limits[c+1]){
+                    if(L.col_indexes[a] < L.col_indexes[b]) ++a;
+                    else if(L.col_indexes[a] > L.col_indexes[b]) ++b;
+                    else val -= L.values[a++] * L.values[b++];
+                }
+                val /= L.diag[c];
+                L.values[j] = val;
+                pivot -= val * val;
+            }
+            L.diag[i] = pivot > 0.0f ? std::sqrt(pivot) : std::sqrt(A.diag[i]);
+        }
+    }
+    return L;
+}
+
+incomplete_cholesky_preconditioner::incomplete_cholesky_preconditioner(csr_matrix const & A) : lower(factorize_incomplete_cholesky(A)), upper(lower.transpose()){}
+
+/*
+ * Symmetric successive over-relaxation: M = (D/w + L) (D/w)^-1 (D/w + U), up to a constant factor
+ */
+struct SSOR_preconditioner{
+    level_scheduled_triangle lower, upper;
+    std::vector<float> scaled_diag;
+
+    SSOR_preconditioner(csr_matrix const & A, float relaxation);
+    void apply(std::vector<float> const & r, std::vector<float> & z) const{
+        z = r;
+        lower.solve(z);
+        #pragma omp parallel for schedule(static, vector_block_size)
+        for(std::uint32_t i=0; i<z.size(); ++i){
+            z[i] *= scaled_diag[i];
+        }
+        upper.solve(z);
+    }
+};
+
+SSOR_preconditioner::SSOR_preconditioner(csr_matrix const & A, float relaxation) : lower(A, true), upper(A, false), scaled_diag(A.diag.size()){
+    assert(relaxation > 0.0f and relaxation < 2.0f);
+    for(std::uint32_t i=0; i<scaled_diag.size(); ++i){
+        scaled_diag[i] = A.diag[i] / relaxation;
+    }
+    lower.diag = scaled_diag;
+    upper.diag = scaled_diag;
+}
+
+/*
+ * Aggregation-based algebraic multigrid, used as a preconditioner with a symmetric V-cycle
+ *
+ * Strongly connected variables are grouped in aggregates, which are the variables of the next coarser level.
+ * The prolongation is piecewise constant and the coarse operators are the Galerkin products R A P: they are never denser than the fine operator.
+ * Smoothing the prolongation would converge in fewer cycles, but the pins of big nets make the coarse operators nearly dense.
+ * The aggregates only depend on the sparsity pattern: they may be given from a previous build, and only the numerical part is recomputed.
+ */
+struct amg_preconditioner{
+    // A rectangular matrix, for the transfers between the levels
+    struct transfer_matrix{
+        std::vector<std::uint32_t> row_limits, col_indexes;
+        std::vector<float> values;
+        std::uint32_t col_cnt;
+
+        transfer_matrix transpose() const;
+        std::vector<float> mul(std::vector<float> const & x) const;
+    };
+
+    static const std::uint32_t max_coarse_size = 1000, max_level_cnt = 16;
+    static constexpr float strength_threshold = 0.08f;
+
+    std::vector<csr_matrix> operators;
+    std::vector<transfer_matrix> prolongations, restrictions;
+    std::vector<float> smoother_weights;
+    // Dense Cholesky factor of the coarsest operator, if it is small enough
+    std::vector<double> coarse_factor;
+
+    // The aggregates of the cache are reused if they were computed for matrices of the same sizes
+    amg_preconditioner(csr_matrix const & A, pattern_cache & cache);
+
+    static std::vector<index_t> aggregate(csr_matrix const & A);
+    static transfer_matrix aggregate_prolongation(std::vector<index_t> const & aggregates);
+    static csr_matrix galerkin_product(transfer_matrix const & R, csr_matrix const & A, transfer_matrix const & P);
+    static float jacobi_weight(csr_matrix const & A);
+
+    void smooth(std::uint32_t l, std::vector<float> const & b, std::vector<float> & x) const;
+    void solve_coarse(std::vector<float> & x) const;
+    std::vector<float> cycle(std::uint32_t l, std::vector<float> const & b) const;
+    void apply(std::vector<float> const & r, std::vector<float> & z) const{
+        z = cycle(0, r);
+    }
+};
+
+amg_preconditioner::transfer_matrix amg_preconditioner::transfer_matrix::transpose() const{
+    transfer_matrix ret;
+    std::uint32_t n = row_limits.size() - 1;
+    ret.col_cnt = n;
+    ret.row_limits.assign(col_cnt+1, 0);
+    ret.col_indexes.resize(col_indexes.size());
+    ret.values.resize(values.size());
+    for(std::uint32_t c : col_indexes){
+        ++ret.row_limits[c+1];
+    }
+    std::partial_sum(ret.row_limits.begin(), ret.row_limits.end(), ret.row_limits.begin());
+    std::vector<std::uint32_t> pos(ret.row_limits.begin(), ret.row_limits.end()-1);
+    for(std::uint32_t i=0; i<n; ++i){
+        for(std::uint32_t j=row_limits[i]; j<row_limits[i+1]; ++j){
+            std::uint32_t ind = pos[col_indexes[j]]++;
+            ret.col_indexes[ind] = i;
+            ret.values[ind] = values[j];
+        }
+    }
+    return ret;
+}
+
+std::vector<float> amg_preconditioner::transfer_matrix::mul(std::vector<float> const & x) const{
+    assert(x.size() == col_cnt);
+    std::vector<float> res(row_limits.size() - 1);
+    #pragma omp parallel for schedule(static, 1024)
+    for(std::uint32_t i=0; i<res.size(); ++i){
+        float cur = 0.0f;
+        for(std::uint32_t j=row_limits[i]; j<row_limits[i+1]; ++j){
+            cur += values[j] * x[col_indexes[j]];
+        }
+        res[i] = cur;
+    }
+    return res;
+}
+
+// Damped Jacobi weight 4/3 rho(D^-1 A)^-1
+float amg_preconditioner::jacobi_weight(csr_matrix const & A){
+    return 4.0f / (3.0f * jacobi_spectral_bound(A));
+}
+
+std::vector<index_t> amg_preconditioner::aggregate(csr_matrix const & A){
+    std::uint32_t n = A.diag.size();
+    index_t const null_agg = std::numeric_limits<index_t>::max();
+    auto is_strong = [&](std::uint32_t i, std::uint32_t j){
+        return std::abs(A.values[j]) >= strength_threshold * std::sqrt(std::abs(A.diag[i] * A.diag[A.col_indexes[j]]));
+    };
+
+    std::vector<index_t> ret(n, null_agg);
+    index_t agg_cnt = 0;
+    // Variables whose strong neighbours are all free form an aggregate with them
+    for(std::uint32_t i=0; i<n; ++i){
+        if(ret[i] != null_agg) continue;
+        bool free_neighbourhood = true;
+        for(std::uint32_t j=A.row_limits[i]; j<A.row_limits[i+1]; ++j){
+            if(is_strong(i, j) and ret[A.col_indexes[j]] != null_agg){
+                free_neighbourhood = false;
+                break;
+            }
+        }
+        if(not free_neighbourhood) continue;
+        ret[i] = agg_cnt;
+        for(std::uint32_t j=A.row_limits[i]; j<A.row_limits[i+1]; ++j){
+            if(is_strong(i, j)) ret[A.col_indexes[j]] = agg_cnt;
+        }
+        ++agg_cnt;
+    }
+    // The others join the aggregate they are most strongly connected to
+    std::vector<index_t> joined = ret;
+    for(std::uint32_t i=0; i<n; ++i){
+        if(ret[i] != null_agg) continue;
+        float best = 0.0f;
+        for(std::uint32_t j=A.row_limits[i]; j<A.row_limits[i+1]; ++j){
+            std::uint32_t c = A.col_indexes[j];
+            if(is_strong(i, j) and ret[c] != null_agg and std::abs(A.values[j]) > best){
+                best = std::abs(A.values[j]);
+                joined[i] = ret[c];
+            }
+        }
+    }
+    ret = joined;
+    // The remaining ones form new aggregates with their free strong neighbours
+    for(std::uint32_t i=0; i<n; ++i){
+        if(ret[i] != null_agg) continue;
+        ret[i] = agg_cnt;
+        for(std::uint32_t j=A.row_limits[i]; j<A.row_limits[i+1]; ++j){
+            if(is_strong(i, j) and ret[A.col_indexes[j]] == null_agg) ret[A.col_indexes[j]] = agg_cnt;
+        }
+        ++agg_cnt;
+    }
+    return ret;
+}
+
+amg_preconditioner::transfer_matrix amg_preconditioner::aggregate_prolongation(std::vector<index_t> const & aggregates){
+    transfer_matrix P;
+    P.col_cnt = aggregates.empty() ? 0 : *std::max_element(aggregates.begin(), aggregates.end()) + 1;
+    P.row_limits.resize(aggregates.size() + 1);
+    std::iota(P.row_limits.begin(), P.row_limits.end(), 0);
+    P.col_indexes = aggregates;
+    P.values.assign(aggregates.size(), 1.0f);
+    return P;
+}
+
+csr_matrix amg_preconditioner::galerkin_product(transfer_matrix const & R, csr_matrix const & A, transfer_matrix const & P){
+    std::uint32_t n = A.diag.size(), coarse_n = P.col_cnt;
+    index_t const null_pos = std::numeric_limits<index_t>::max();
+    // Rows of A P, accumulated with a dense marker
+    std::vector<index_t> positions(coarse_n, null_pos);
+    transfer_matrix AP;
+    AP.col_cnt = coarse_n;
+    AP.row_limits.push_back(0);
+    auto add_row = [&](std::uint32_t r, float scale, transfer_matrix const & M, transfer_matrix & out){
+        for(std::uint32_t j=M.row_limits[r]; j<M.row_limits[r+1]; ++j){
+            index_t c = M.col_indexes[j];
+            if(positions[c] == null_pos or positions[c] < out.row_limits.back()){
+                positions[c] = out.col_indexes.size();
+                out.col_indexes.push_back(c);
+                out.values.push_back(scale * M.values[j]);
+            }
+            else{
+                out.values[positions[c]] += scale * M.values[j];
+            }
+        }
+    };
+    for(std::uint32_t i=0; i<n; ++i){
+        add_row(i, A.diag[i], P, AP);
+        for(std::uint32_t j=A.row_limits[i]; j<A.row_limits[i+1]; ++j){
+            add_row(A.col_indexes[j], A.values[j], P, AP);
+        }
+        AP.row_limits.push_back(AP.col_indexes.size());
+    }
+
+    // Rows of R A P, with the diagonal apart
+    std::fill(positions.begin(), positions.end(), null_pos);
+    transfer_matrix RAP;
+    RAP.col_cnt = coarse_n;
+    RAP.row_limits.push_back(0);
+    for(std::uint32_t k=0; k<coarse_n; ++k){
+        for(std::uint32_t j=R.row_limits[k]; j<R.row_limits[k+1]; ++j){
+            add_row(R.col_indexes[j], R.values[j], AP, RAP);
+        }
+        RAP.row_limits.push_back(RAP.col_indexes.size());
+    }
+    std::vector<std::uint32_t> row_limits(1, 0), col_indexes;
+    std::vector<float> values, diag(coarse_n, 0.0f);
+    for(std::uint32_t k=0; k<coarse_n; ++k){
+        for(std::uint32_t j=RAP.row_limits[k]; j<RAP.row_limits[k+1]; ++j){
+            if(RAP.col_indexes[j] == k){
+                diag[k] += RAP.values[j];
+            }
+            else{
+                col_indexes.push_back(RAP.col_indexes[j]);
+                values.push_back(RAP.values[j]);
+            }
+        }
+        row_limits.push_back(col_indexes.size());
+    }
+    return csr_matrix(row_limits, col_indexes, values, diag);
+}
+
+amg_preconditioner::amg_preconditioner(csr_matrix const & A, pattern_cache & cache){
+    std::vector<std::vector<index_t> > & aggregates = cache.amg_aggregates;
+    std::vector<std::pair<index_t, index_t> > & level_sizes = cache.amg_level_sizes;
+    operators.push_back(A);
+    for(std::uint32_t l=0; l+1 < max_level_cnt and operators.back().diag.size() > max_coarse_size; ++l){
+        csr_matrix const & cur = operators.back();
+        std::pair<index_t, index_t> cur_sizes(cur.diag.size(), cur.col_indexes.size());
+        if(aggregates.size() > l and level_sizes[l] != cur_sizes){
+            // Computed for another matrix: this level and the next ones are recomputed
+            aggregates.resize(l);
+            level_sizes.resize(l);
+        }
+        if(aggregates.size() <= l){
+            aggregates.push_back(aggregate(cur));
+            level_sizes.push_back(cur_sizes);
+        }
+        transfer_matrix P = aggregate_prolongation(aggregates[l]);
+        // Stop if the coarsening stalls
+        if(4 * P.col_cnt > 3 * cur.diag.size()) break;
+        smoother_weights.push_back(jacobi_weight(cur));
+        restrictions.push_back(P.transpose());
+        prolongations.push_back(std::move(P));
+        operators.push_back(galerkin_product(restrictions.back(), cur, prolongations.back()));
+    }
+    smoother_weights.push_back(jacobi_weight(operators.back()));
+
+    // Dense factorization of the coarsest level
+    csr_matrix const & coarse = operators.back();
+    std::uint32_t n = coarse.diag.size();
+    if(n <= max_coarse_size){
+        coarse_factor.assign(static_cast<std::size_t>(n) * n, 0.0);
+        for(std::uint32_t i=0; i<n; ++i){
+            coarse_factor[i*n+i] = coarse.diag[i];
+            for(std::uint32_t j=coarse.row_limits[i]; j<coarse.row_limits[i+1]; ++j){
+                coarse_factor[i*n + coarse.col_indexes[j]] += coarse.values[j];
+            }
+        }
+        for(std::uint32_t j=0; j<n; ++j){
+            double pivot = coarse_factor[j*n+j];
+            for(std::uint32_t k=0; k<j; ++k) pivot -= coarse_factor[j*n+k] * coarse_factor[j*n+k];
+            pivot = pivot > 0.0 ? std::sqrt(pivot) : std::sqrt(std::abs(coarse.diag[j]));
+            coarse_factor[j*n+j] = pivot;
+            for(std::uint32_t i=j+1; i<n; ++i){
+                double val = coarse_factor[i*n+j];
+                for(std::uint32_t k=0; k<j; ++k) val -= coarse_factor[i*n+k] * coarse_factor[j*n+k];
+                coarse_factor[i*n+j] = val / pivot;
+            }
+        }
+    }
+}
+
+// x += w D^-1 (b - A x)
+void amg_preconditioner::smooth(std::uint32_t l, std::vector<float> const & b, std::vector<float> & x) const{
+    csr_matrix const & A = operators[l];
+    std::vector<float> Ax = A.mul(x);
+    float weight = smoother_weights[l];
+    #pragma omp parallel for schedule(static, 1024)
+    for(std::uint32_t i=0; i<x.size(); ++i){
+        x[i] += weight * (b[i] - Ax[i]) / A.diag[i];
+    }
+}
+
+void amg_preconditioner::solve_coarse(std::vector<float> & x) const{
+    std::uint32_t n = x.size();
+    std::vector<double> y(x.begin(), x.end());
+    for(std::uint32_t i=0; i<n; ++i){
+        for(std::uint32_t k=0; k<i; ++k) y[i] -= coarse_factor[i*n+k] * y[k];
+        y[i] /= coarse_factor[i*n+i];
+    }
+    for(std::uint32_t i=n; i-- > 0;){
+        for(std::uint32_t k=i+1; k<n; ++k) y[i] -= coarse_factor[k*n+i] * y[k];
+        y[i] /= coarse_factor[i*n+i];
+    }
+    std::copy(y.begin(), y.end(), x.begin());
+}
+
+std::vector<float> amg_preconditioner::cycle(std::uint32_t l, std::vector<float> const & b) const{
+    std::vector<float> x(b.size(), 0.0f);
+    if(l+1 == operators.size()){
+        if(not coarse_factor.empty()){
+            x = b;
+            solve_coarse(x);
+        }
+        else{
+            for(int k=0; k<4; ++k) smooth(l, b, x);
+        }
+        return x;
+    }
+    // The pre- and post-smoothing are the same, so that the preconditioner is symmetric
+    smooth(l, b, x);
+    std::vector<float> residual = operators[l].mul(x);
+    for(std::uint32_t i=0; i<residual.size(); ++i){
+        residual[i] = b[i] - residual[i];
+    }
+    std::vector<float> correction = prolongations[l].mul(cycle(l+1, restrictions[l].mul(residual)));
+    for(std::uint32_t i=0; i<x.size(); ++i){
+        x[i] += correction[i];
+    }
+    smooth(l, b, x);
+    return x;
+}
+
+/*
+ * Reverse Cuthill-McKee order of the variables of a matrix, as the original index of each new variable
+ *
+ * Each connected component is traversed breadth-first from a pseudo-peripheral variable, visiting the neighbours by increasing degree.
+ * The reversed order gives a small bandwidth: the columns of each row are close to the row, and the products access the vectors almost sequentially.
+ */
+std::vector<std::uint32_t> reverse_cuthill_mckee(csr_matrix const & A){
+    std::uint32_t n = A.diag.size();
+    auto degree = [&](std::uint32_t i){ return A.row_limits[i+1] - A.row_limits[i]; };
+    std::vector<std::uint32_t> order, level(n);
+    order.reserve(n);
+    std::vector<bool> visited(n, false);
+
+    // Breadth-first traversal from a variable, appending the variables to the order; returns the first variable of the last level
+    auto traverse = [&](std::uint32_t start) -> std::uint32_t{
+        std::uint32_t begin = order.size();
+        order.push_back(start);
+        visited[start] = true;
+        level[start] = 0;
+        std::vector<std::uint32_t> neighbours;
+        for(std::uint32_t k=begin; k<order.size(); ++k){
+            std::uint32_t i = order[k];
+            neighbours.clear();
+            for(std::uint32_t j=A.row_limits[i]; j<A.row_limits[i+1]; ++j){
+                std::uint32_t c = A.col_indexes[j];
+                if(not visited[c]){
+                    visited[c] = true;
+                    level[c] = level[i] + 1;
+                    neighbours.push_back(c);
+                }
+            }
+            std::stable_sort(neighbours.begin(), neighbours.end(), [&](std::uint32_t a, std::uint32_t b){ return degree(a) < degree(b); });
+            order.insert(order.end(), neighbours.begin(), neighbours.end());
+        }
+        std::uint32_t last = order.back();
+        for(std::uint32_t k=order.size(); k>begin and level[order[k-1]] == level[last]; --k){
+            if(degree(order[k-1]) < degree(last)) last = order[k-1];
+        }
+        return last;
+    };
+    // Forget a traversal
+    auto undo = [&](std::uint32_t begin){
+        for(std::uint32_t k=begin; k<order.size(); ++k) visited[order[k]] = false;
+        order.resize(begin);
+    };
+
+    for(std::uint32_t s=0; s<n; ++s){
+        if(visited[s]) continue;
+        // Move to a variable of the last level while the depth increases (George-Liu)
+        std::uint32_t begin = order.size(), start = s;
+        std::uint32_t last = traverse(start), depth = level[order.back()];
+        for(int it=0; it<4; ++it){
+            undo(begin);
+            std::uint32_t new_last = traverse(last);
+            std::uint32_t new_depth = level[order.back()];
+            if(new_depth <= depth){
+                undo(begin);
+                traverse(start);
+                break;
+            }
+            start = last;
+            last = new_last;
+            depth = new_depth;
+        }
+    }
+    std::reverse(order.begin(), order.end());
+    return order;
+}
+
+/*
+ * Two-level additive Schwarz preconditioner: M^-1 = sum_i R_i^T A_i^-1 R_i + R_0^T A_0^-1 R_0
+ *
+ * The variables are split in subdomains of consecutive variables in reverse Cuthill-McKee order, which are compact in the netlist,
+ * and each subdomain is extended by a few layers of neighbours to overlap with the others.
+ * Each local matrix A_i has its own incomplete Cholesky factorization: the factorizations and the local solves of the subdomains run in parallel,
+ * without the synchronizations of the global triangular solves.
+ * The coarse level has one variable per subdomain, constant on the variables it owns (Nicolaides), so that the convergence doesn't degrade with the number of subdomains.
+ * The subdomains only depend on the sparsity pattern: they are kept with the structure of the matrix.
+ */
+struct schwarz_preconditioner{
+    // The subdomains, from the cache: the variables of each subdomain, its own variables first
+    std::vector<std::uint32_t> const & limits, & variables, & owned;
+    // The factorizations of the local matrices, and the local vectors
+    std::vector<level_scheduled_triangle> lower, upper;
+    mutable std::vector<std::vector<float> > local_vectors;
+    // The positions of each variable in the local vectors, as subdomain and local index
+    std::vector<std::uint32_t> position_limits;
+    std::vector<std::pair<std::uint32_t, std::uint32_t> > positions;
+    // The subdomain owning each variable, and the factorized coarse matrix
+    std::vector<std::uint32_t> owners;
+    std::vector<double> coarse_matrix;
+    mutable std::vector<double> coarse_vector;
+
+    static void compute_subdomains(csr_matrix const & A, std::uint32_t subdomain_cnt, std::uint32_t overlap, pattern_cache & cache);
+
+    schwarz_preconditioner(csr_matrix const & A, std::uint32_t subdomain_cnt, std::uint32_t overlap, pattern_cache & cache);
+    std::uint32_t subdomain_cnt() const{ return limits.size() - 1; }
+    void apply(std::vector<float> const & r, std::vector<float> & z) const;
+};
+
+void schwarz_preconditioner::compute_subdomains(csr_matrix const & A, std::uint32_t subdomain_cnt, std::uint32_t overlap, pattern_cache & cache){
+    std::uint32_t const null_ind = std::numeric_limits<std::uint32_t>::max();
+    std::uint32_t n = A.diag.size();
+    std::uint32_t K = std::max<std::uint32_t>(1, std::min(subdomain_cnt, n));
+    std::vector<std::uint32_t> order = reverse_cuthill_mckee(A);
+    cache.schwarz_limits.assign(1, 0);
+    cache.schwarz_variables.clear();
+    cache.schwarz_owned.clear();
+    cache.schwarz_parameters = std::make_pair(subdomain_cnt, overlap);
+    // The last subdomain in which each variable was added
+    std::vector<std::uint32_t> mark(n, null_ind);
+    for(std::uint32_t s=0; s<K; ++s){
+        std::uint32_t begin = cache.schwarz_variables.size();
+        for(std::uint32_t k = static_cast<std::uint64_t>(s) * n / K; k < static_cast<std::uint64_t>(s+1) * n / K; ++k){
+            cache.schwarz_variables.push_back(order[k]);
+            mark[order[k]] = s;
+        }
+        cache.schwarz_owned.push_back(cache.schwarz_variables.size() - begin);
+        // Add the neighbours of the last layer
+        std::uint32_t layer_begin = begin;
+        for(std::uint32_t l=0; l<overlap; ++l){
+            std::uint32_t layer_end = cache.schwarz_variables.size();
+            for(std::uint32_t k=layer_begin; k<layer_end; ++k){
+                std::uint32_t i = cache.schwarz_variables[k];
+                for(std::uint32_t j=A.row_limits[i]; j<A.row_limits[i+1]; ++j){
+                    std::uint32_t c = A.col_indexes[j];
+                    if(mark[c] != s){
+                        mark[c] = s;
+                        cache.schwarz_variables.push_back(c);
+                    }
+                }
+            }
+            layer_begin = layer_end;
+        }
+        cache.schwarz_limits.push_back(cache.schwarz_variables.size());
+    }
+}
+
+schwarz_preconditioner::schwarz_preconditioner(csr_matrix const & A, std::uint32_t subdomain_cnt, std::uint32_t overlap, pattern_cache & cache) :
+        limits(cache.schwarz_limits), variables(cache.schwarz_variables), owned(cache.schwarz_owned){
+    std::uint32_t n = A.diag.size();
+    if(cache.schwarz_parameters != std::pair<index_t, index_t>(subdomain_cnt, overlap)
+        or limits.empty() or limits.back() == 0 or owned.size() + 1 != limits.size() or std::accumulate(owned.begin(), owned.end(), 0u) != n){
+        compute_subdomains(A, subdomain_cnt, overlap, cache);
+    }
+    std::uint32_t K = limits.size() - 1;
+
+    owners.resize(n);
+    for(std::uint32_t s=0; s<K; ++s){
+        for(std::uint32_t k=limits[s]; k<limits[s]+owned[s]; ++k){
+            owners[variables[k]] = s;
+        }
+    }
+    position_limits.assign(n+1, 0);
+    for(std::uint32_t v : variables) ++position_limits[v+1];
+    std::partial_sum(position_limits.begin(), position_limits.end(), position_limits.begin());
+    positions.resize(variables.size());
+    std::vector<std::uint32_t> cur(position_limits.begin(), position_limits.end()-1);
+    for(std::uint32_t s=0; s<K; ++s){
+        for(std::uint32_t k=limits[s]; k<limits[s+1]; ++k){
+            positions[cur[variables[k]]++] = std::make_pair(s, k - limits[s]);
+        }
+    }
+
+    // The local matrices and their factorizations
+    lower.resize(K);
+    upper.resize(K);
+    local_vectors.resize(K);
+    #pragma omp parallel for schedule(dynamic)
+    for(std::uint32_t s=0; s<K; ++s){
+        std::uint32_t size = limits[s+1] - limits[s];
+        std::vector<std::pair<std::uint32_t, std::uint32_t> > local_indexes(size);
+        for(std::uint32_t k=0; k<size; ++k) local_indexes[k] = std::make_pair(variables[limits[s] + k], k);
+        std::sort(local_indexes.begin(), local_indexes.end());
+        csr_matrix local;
+        local.row_limits.push_back(0);
+        for(std::uint32_t k=0; k<size; ++k){
+            std::uint32_t i = variables[limits[s] + k];
+            for(std::uint32_t j=A.row_limits[i]; j<A.row_limits[i+1]; ++j){
+                auto it = std::lower_bound(local_indexes.begin(), local_indexes.end(), std::make_pair(A.col_indexes[j], 0u));
+                if(it != local_indexes.end() and it->first == A.col_indexes[j]){
+                    local.col_indexes.push_back(it->second);
+                    local.values.push_back(A.values[j]);
+                }
+            }
+            local.row_limits.push_back(local.col_indexes.size());
+            local.diag.push_back(A.diag[i]);
+        }
+        lower[s] = factorize_incomplete_cholesky(local);
+        upper[s] = lower[s].transpose();
+        local_vectors[s].resize(size);
+    }
+
+    // The coarse matrix R_0 A R_0^T, summing the elements between the owned variables
+    coarse_matrix.assign(K*K, 0.0);
+    for(std::uint32_t i=0; i<n; ++i){
+        std::uint32_t a = owners[i];
+        coarse_matrix[a*K+a] += A.diag[i];
+        for(std::uint32_t j=A.row_limits[i]; j<A.row_limits[i+1]; ++j){
+            coarse_matrix[a*K+owners[A.col_indexes[j]]] += A.values[j];
+        }
+    }
+    if(not dense_cholesky(coarse_matrix, K)) coarse_matrix.clear();
+    coarse_vector.resize(K);
+}
+
+void schwarz_preconditioner::apply(std::vector<float> const & r, std::vector<float> & z) const{
+    std::uint32_t n = r.size(), K = subdomain_cnt();
+    z.resize(n);
+    #pragma omp parallel for schedule(dynamic)
+    for(std::uint32_t s=0; s<K; ++s){
+        std::vector<float> & local = local_vectors[s];
+        double coarse_sum = 0.0;
+        for(std::uint32_t k=limits[s]; k<limits[s+1]; ++k){
+            local[k - limits[s]] = r[variables[k]];
+        }
+        for(std::uint32_t k=limits[s]; k<limits[s]+owned[s]; ++k){
+            coarse_sum += r[variables[k]];
+        }
+        coarse_vector[s] = coarse_sum;
+        lower[s].solve(local);
+        upper[s].solve(local);
+    }
+    if(not coarse_matrix.empty()){
+        dense_cholesky_solve(coarse_matrix, K, coarse_vector);
+    }
+    else{
+        std::fill(coarse_vector.begin(), coarse_vector.end(), 0.0);
+    }
+    // Sum the contributions of the subdomains in a fixed order
+    #pragma omp parallel for schedule(static, vector_block_size)
+    for(std::uint32_t i=0; i<n; ++i){
+        float sum = coarse_vector[owners[i]];
+        for(std::uint32_t p=position_limits[i]; p<position_limits[i+1]; ++p){
+            sum += local_vectors[positions[p].first][positions[p].second];
+        }
+        z[i] = sum;
+    }
+}
+
+// Conjugate gradient with the preconditioner of the options, built from the compressed matrix; the product may use another format
+template<typename matrix_t>
+void solve_CG_with_options(matrix_t const & A, csr_matrix const & mat, std::vector<float> const & goal, std::vector<float> & x, std::uint32_t nbr_iter, solver_options const & options, pattern_cache * cache, solver_report & report, solver_workspace & ws){
+    stopping_criteria criteria(nbr_iter, options);
+    if(options.preconditioner == AMGPreconditioner){
+        // The aggregates are kept with the structure of the matrix when there is one
+        pattern_cache local_cache;
+        pattern_cache & used_cache = cache != nullptr ? *cache : local_cache;
+        solve_refined(A, amg_preconditioner(mat, used_cache), mat, goal, x, criteria, options, 0.0f, report, ws);
+    }
+    else if(options.preconditioner == SchwarzPreconditioner){
+        // The subdomains are kept with the structure of the matrix when there is one
+        pattern_cache local_cache;
+        pattern_cache & used_cache = cache != nullptr ? *cache : local_cache;
+        solve_refined(A, schwarz_preconditioner(mat, options.schwarz_subdomains, options.schwarz_overlap, used_cache), mat, goal, x, criteria, options, 0.0f, report, ws);
+    }
+    else if(options.preconditioner == IncompleteCholeskyPreconditioner){
+        solve_refined(A, incomplete_cholesky_preconditioner(mat), mat, goal, x, criteria, options, 0.0f, report, ws);
+    }
+    else if(options.preconditioner == SSORPreconditioner){
+        solve_refined(A, SSOR_preconditioner(mat, options.SSOR_relaxation), mat, goal, x, criteria, options, 0.0f, report, ws);
+    }
+    else{
+        float spectral_bound = options.solver == ChebyshevSolver ? jacobi_spectral_bound(mat) : 0.0f;
+        solve_refined(A, jacobi_preconditioner(mat.diag, ws.inverse_diag), mat, goal, x, criteria, options, spectral_bound, report, ws);
+    }
+}
+
+/*
+ * The Schur complement of a matrix on its first variables, when the other variables are only coupled to them (star model)
+ *
+ * The eliminated variables are never iterated on: their contribution is applied implicitly in the product as A_ii - A_ie D_e^-1 A_ei.
+ * The matrix is supposed symmetric.
+ */
+struct condensed_matrix{
+    // The block of the internal variables
+    std::vector<std::uint32_t> row_limits, col_indexes;
+    std::vector<float> values, internal_diag;
+    // The coupling of the internal rows with the eliminated variables and conversely
+    std::vector<std::uint32_t> ext_row_limits, ext_col_indexes;
+    std::vector<float> ext_values;
+    std::vector<std::uint32_t> elim_row_limits, elim_col_indexes;
+    std::vector<float> elim_values, elim_diag;
+    // The diagonal of the Schur complement, for the preconditioner
+    std::vector<float> diag;
+    // The eliminated variables during a product, kept between them
+    mutable std::vector<float> elim;
+
+    static bool is_condensable(csr_matrix const & A, std::uint32_t n);
+    condensed_matrix(csr_matrix const & A, std::uint32_t n);
+
+    void mul(std::vector<float> const & x, std::vector<float> & res) const;
+    // Solve with a target for all variables, for the internal variables only
+    void solve_CG(std::vector<float> const & goal, std::vector<float> & x, stopping_criteria const & criteria, solver_report & report, solver_workspace & ws) const;
+};
+
+bool condensed_matrix::is_condensable(csr_matrix const & A, std::uint32_t n){
+    for(std::uint32_t i=n; i<A.diag.size(); ++i){
+        if(not (A.diag[i] > 0.0f)) return false;
+        for(std::uint32_t j=A.row_limits[i]; j<A.row_limits[i+1]; ++j){
+            if(A.col_indexes[j] >= n) return false;
+        }
+    }
+    return true;
+}
+
+condensed_matrix::condensed_matrix(csr_matrix const & A, std::uint32_t n) : internal_diag(A.diag.begin(), A.diag.begin() + n), diag(internal_diag){
+    assert(is_condensable(A, n));
+    row_limits.push_back(0);
+    ext_row_limits.push_back(0);
+    for(std::uint32_t i=0; i<n; ++i){
+        for(std::uint32_t j=A.row_limits[i]; j<A.row_limits[i+1]; ++j){
+            std::uint32_t c = A.col_indexes[j];
+            if(c < n){
+                col_indexes.push_back(c);
+                values.push_back(A.values[j]);
+            }
+            else{
+                ext_col_indexes.push_back(c-n);
+                ext_values.push_back(A.values[j]);
+                diag[i] -= A.values[j] * A.values[j] / A.diag[c];
+            }
+        }
+        row_limits.push_back(col_indexes.size());
+        ext_row_limits.push_back(ext_col_indexes.size());
+    }
+    elim_diag.assign(A.diag.begin() + n, A.diag.end());
+    elim_row_limits.assign(A.row_limits.begin() + n, A.row_limits.end());
+    for(std::uint32_t & l : elim_row_limits){
+        l -= A.row_limits[n];
+    }
+    elim_col_indexes.assign(A.col_indexes.begin() + A.row_limits[n], A.col_indexes.end());
+    elim_values.assign(A.values.begin() + A.row_limits[n], A.values.end());
+}
+
+void condensed_matrix::mul(std::vector<float> const & x, std::vector<float> & res) const{
+    assert(x.size() == internal_diag.size());
+    // Solve the eliminated variables for this value of the internal ones
+    elim.resize(elim_diag.size());
+    #pragma omp parallel for schedule(static, 1024)
+    for(std::uint32_t e=0; e<elim_diag.size(); ++e){
+        float cur = 0.0;
+        for(std::uint32_t j=elim_row_limits[e]; j<elim_row_limits[e+1]; ++j){
+            cur += elim_values[j] * x[elim_col_indexes[j]];
+        }
+        elim[e] = cur / elim_diag[e];
+    }
+    res.resize(x.size());
+    #pragma omp parallel for schedule(static, 1024)
+    for(std::uint32_t i=0; i<x.size(); ++i){
+        float cur = internal_diag[i] * x[i];
+        for(std::uint32_t j=row_limits[i]; j<row_limits[i+1]; ++j){
+            cur += values[j] * x[col_indexes[j]];
+        }
+        for(std::uint32_t j=ext_row_limits[i]; j<ext_row_limits[i+1]; ++j){
+            cur -= ext_values[j] * elim[ext_col_indexes[j]];
+        }
+        res[i] = cur;
+    }
+}
+
+void condensed_matrix::solve_CG(std::vector<float> const & goal, std::vector<float> & x, stopping_criteria const & criteria, solver_report & report, solver_workspace & ws) const{
+    std::uint32_t n = internal_diag.size();
+    assert(goal.size() == n + elim_diag.size());
+    assert(x.size() == n);
+
+    // The target of the eliminated variables is moved to the internal ones
+    std::vector<float> condensed_goal(goal.begin(), goal.begin() + n);
+    for(std::uint32_t i=0; i<n; ++i){
+        for(std::uint32_t j=ext_row_limits[i]; j<ext_row_limits[i+1]; ++j){
+            std::uint32_t e = ext_col_indexes[j];
+            condensed_goal[i] -= ext_values[j] * goal[n+e] / elim_diag[e];
+        }
+    }
+    solve_jacobi_CG(*this, diag, condensed_goal, x, criteria, report, ws);
+}
+
+template<std::uint32_t unroll_len>
+std::vector<float> ellpack_matrix<unroll_len>::solve_CG(std::vector<float> goal, std::vector<float> x, std::uint32_t min_iter, std::uint32_t max_iter, float tol_ratio) const{
+    std::uint32_t n = diag.size();
+    std::uint32_t old_n = x.size();
+    assert(goal.size() == x.size());
+    x.resize(diag.size(), 0.0);
+    goal.resize(diag.size(), 0.0);
+
+    std::vector<float> r, p(n), z(n), mul_res, preconditioner(n);
+    r = mul(x);
+    for(uint32_t i=0; i<n; ++i){
+        r[i] = goal[i] - r[i];
         preconditioner[i] = 1.0/diag[i];
         z[i] = preconditioner[i] * r[i];
         p[i] = z[i];
@@ -365,18 +2693,632 @@ std::vector<float> ellpack_matrix<unroll_len>::solve_CG(std::vector<float> goal,
     return x;
 }
 
-std::vector<float_t> linear_system::solve_CG(std::vector<float_t> guess, index_t nbr_iter){
+bound_to_bound_system & bound_to_bound_system::operator+=(linear_system const & o){
+    if(o.internal_size() != size() or o.size() != size()){ throw std::runtime_error("Mismatched system sizes"); }
+    for(matrix_triplet const t : o.matrix_){
+        if(t.r_ != t.c_){ throw std::runtime_error("Only diagonal systems can be added to a matrix-free system"); }
+        diag_[t.r_] += t.val_;
+    }
+    for(index_t i=0; i<size(); ++i){
+        target_[i] += o.target_[i];
+    }
+    return *this;
+}
+
+std::vector<float> bound_to_bound_system::mul(std::vector<float> const & x) const{
+    std::vector<float> res;
+    mul(x, res);
+    return res;
+}
+
+void bound_to_bound_system::mul(std::vector<float> const & x, std::vector<float> & res) const{
+    assert(x.size() == size());
+    res.resize(x.size());
+    for(index_t i=0; i<size(); ++i){
+        res[i] = diag_[i] * x[i];
+    }
+    for(index_t n=0; n<net_cnt(); ++n){
+        index_t lower = lower_bounds_[n], upper = upper_bounds_[n];
+        float lower_x = lower != null_ind ? x[lower] : 0.0f;
+        float upper_x = upper != null_ind ? x[upper] : 0.0f;
+
+        // Pull the pins towards the bounds, and sum their pull on the bounds
+        float lower_sum = bound_weights_[n] * upper_x, upper_sum = bound_weights_[n] * lower_x;
+        for(index_t p=net_limits_[n]; p<net_limits_[n+1]; ++p){
+            index_t v = pin_variables_[p];
+            res[v] -= lower_weights_[p] * lower_x + upper_weights_[p] * upper_x;
+            lower_sum += lower_weights_[p] * x[v];
+            upper_sum += upper_weights_[p] * x[v];
+        }
+        if(lower != null_ind) res[lower] -= lower_sum;
+        if(upper != null_ind) res[upper] -= upper_sum;
+    }
+}
+
+std::vector<float_t> bound_to_bound_system::solve_CG(std::vector<float_t> guess, index_t nbr_iter, solver_options const & options, solver_report * report) const{
+    assert(guess.size() == size());
+    auto start = std::chrono::steady_clock::now();
+    solver_workspace ws;
+    solver_report local_report;
+    solver_report & used_report = report != nullptr ? *report : local_report;
+    solve_jacobi_CG(*this, diag_, target_, guess, stopping_criteria(nbr_iter, options), used_report, ws);
+    used_report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return guess;
+}
+
+/*
+ * The variables of a system that are coupled to others, renumbered in the same order
+ *
+ * The other variables (fixed cells, cells without nets) only have a diagonal element, and are solved directly.
+ * Since the order is kept, the additional variables remain after the internal ones.
+ */
+struct coupled_variables{
+    static const std::uint32_t null_ind = std::numeric_limits<std::uint32_t>::max();
+    // In the storage of a workspace
+    std::vector<std::uint32_t> & new_indexes, & old_indexes;
+    std::uint32_t internal_cnt;
+
+    coupled_variables(csr_matrix const & A, std::uint32_t n, std::vector<std::uint32_t> & new_i, std::vector<std::uint32_t> & old_i);
+    std::uint32_t size() const{ return old_indexes.size(); }
+
+    void restrict_matrix(csr_matrix const & A, csr_matrix & res) const;
+    // The missing values of shorter vectors are null
+    void restrict_vector(std::vector<float> const & v, std::vector<float> & res) const;
+    // The solution of the first n variables from the solution of the coupled ones: the others are solved directly, or keep their guess if they have no diagonal
+    void expand_solution(csr_matrix const & A, std::vector<float> const & goal, std::vector<float> const & guess, std::vector<float> const & coupled_sol, std::uint32_t n, std::vector<float> & sol) const;
+};
+
+coupled_variables::coupled_variables(csr_matrix const & A, std::uint32_t n, std::vector<std::uint32_t> & new_i, std::vector<std::uint32_t> & old_i) : new_indexes(new_i), old_indexes(old_i), internal_cnt(0){
+    // Mark the coupled variables, then number them
+    new_indexes.assign(A.diag.size(), static_cast<std::uint32_t>(null_ind));
+    old_indexes.clear();
+    for(std::uint32_t i=0; i<A.diag.size(); ++i){
+        for(std::uint32_t j=A.row_limits[i]; j<A.row_limits[i+1]; ++j){
+            new_indexes[i] = 0;
+            new_indexes[A.col_indexes[j]] = 0;
+        }
+    }
+    for(std::uint32_t i=0; i<A.diag.size(); ++i){
+        if(new_indexes[i] != null_ind){
+            new_indexes[i] = old_indexes.size();
+            old_indexes.push_back(i);
+            if(i < n) ++internal_cnt;
+        }
+    }
+}
+
+void coupled_variables::restrict_matrix(csr_matrix const & A, csr_matrix & res) const{
+    res.row_limits.assign(1, 0);
+    res.col_indexes.clear();
+    res.values.clear();
+    res.diag.clear();
+    for(std::uint32_t i : old_indexes){
+        for(std::uint32_t j=A.row_limits[i]; j<A.row_limits[i+1]; ++j){
+            res.col_indexes.push_back(new_indexes[A.col_indexes[j]]);
+            res.values.push_back(A.values[j]);
+        }
+        res.row_limits.push_back(res.col_indexes.size());
+        res.diag.push_back(A.diag[i]);
+    }
+}
+
+void coupled_variables::restrict_vector(std::vector<float> const & v, std::vector<float> & res) const{
+    res.resize(size());
+    for(std::uint32_t i=0; i<size(); ++i){
+        res[i] = old_indexes[i] < v.size() ? v[old_indexes[i]] : 0.0f;
+    }
+}
+
+void coupled_variables::expand_solution(csr_matrix const & A, std::vector<float> const & goal, std::vector<float> const & guess, std::vector<float> const & coupled_sol, std::uint32_t n, std::vector<float> & sol) const{
+    sol.resize(n);
+    for(std::uint32_t i=0; i<n; ++i){
+        std::uint32_t ind = new_indexes[i];
+        if(ind != null_ind){
+            sol[i] = coupled_sol[ind];
+        }
+        else if(A.diag[i] > 0.0f){
+            sol[i] = goal[i] / A.diag[i];
+        }
+        else{
+            sol[i] = i < guess.size() ? guess[i] : 0.0f;
+        }
+    }
+}
+
+// Resolve the automatic choice of format
+MatrixFormat select_format(csr_matrix const & mat, MatrixFormat format){
+    if(format != AutomaticFormat) return format;
+    // The vectorized products of SELL outweigh its padding up to about twice the elements of CSR
+    std::uint64_t nonzero_cnt = mat.col_indexes.size();
+    return sell_matrix::padded_size(mat) <= 2 * nonzero_cnt ? SELLFormat : CSRFormat;
+}
+
+// Compute the order of the variables and the pattern of the reordered matrix, unless the cache already holds them for this size
+void update_reordering(csr_matrix const & mat, pattern_cache & cache){
+    std::uint32_t n = mat.diag.size();
+    if(cache.reordering.size() == n and cache.reordered_elements.size() == mat.col_indexes.size()) return;
+    cache.reordering = reverse_cuthill_mckee(mat);
+    std::vector<std::uint32_t> new_index(n);
+    for(std::uint32_t i=0; i<n; ++i) new_index[cache.reordering[i]] = i;
+
+    csr_matrix & res = cache.reordered_matrix;
+    res.row_limits.assign(1, 0);
+    res.col_indexes.clear();
+    cache.reordered_elements.clear();
+    std::vector<std::pair<std::uint32_t, std::uint32_t> > row;
+    for(std::uint32_t i=0; i<n; ++i){
+        std::uint32_t o = cache.reordering[i];
+        row.clear();
+        for(std::uint32_t j=mat.row_limits[o]; j<mat.row_limits[o+1]; ++j){
+            row.push_back(std::make_pair(new_index[mat.col_indexes[j]], j));
+        }
+        std::sort(row.begin(), row.end());
+        for(auto const & elt : row){
+            res.col_indexes.push_back(elt.first);
+            cache.reordered_elements.push_back(elt.second);
+        }
+        res.row_limits.push_back(res.col_indexes.size());
+    }
+    res.values.resize(res.col_indexes.size());
+    res.diag.resize(n);
+}
+
+// Solve with the product in the format of the options
+void solve_in_format(csr_matrix const & mat, std::vector<float> const & goal, std::vector<float> & x, std::uint32_t nbr_iter, solver_options const & options, pattern_cache * cache, solver_report & report, solver_workspace & ws){
+    MatrixFormat format = select_format(mat, options.format);
+    if(format == DeltaCSRFormat){
+        // Use the smallest offsets if it saves memory despite the escapes
+        std::uint64_t bytes_8 = delta_csr_matrix<std::int8_t>::index_bytes(mat), bytes_16 = delta_csr_matrix<std::int16_t>::index_bytes(mat);
+        std::uint64_t bytes_32 = mat.col_indexes.size() * sizeof(std::uint32_t);
+        if(bytes_8 <= bytes_16 and bytes_8 < bytes_32){
+            delta_csr_matrix<std::int8_t> compressed(mat);
+            solve_CG_with_options(compressed, mat, goal, x, nbr_iter, options, cache, report, ws);
+        }
+        else if(bytes_16 < bytes_32){
+            delta_csr_matrix<std::int16_t> compressed(mat);
+            solve_CG_with_options(compressed, mat, goal, x, nbr_iter, options, cache, report, ws);
+        }
+        else{
+            solve_CG_with_options(mat, mat, goal, x, nbr_iter, options, cache, report, ws);
+        }
+    }
+    else if(format == SymmetricFormat){
+        symmetric_csr_matrix symmetric(mat);
+        solve_CG_with_options(symmetric, mat, goal, x, nbr_iter, options, cache, report, ws);
+    }
+    else if(format == SELLFormat){
+        sell_matrix sliced(mat);
+        solve_CG_with_options(sliced, mat, goal, x, nbr_iter, options, cache, report, ws);
+    }
+    else{
+        solve_CG_with_options(mat, mat, goal, x, nbr_iter, options, cache, report, ws);
+    }
+}
+
+// Solve a compressed system in place, starting from x; only the first internal_size variables are kept
+void solve_compressed_system(csr_matrix const & mat, std::vector<float> const & goal, std::vector<float> & x, std::uint32_t internal_size, std::uint32_t nbr_iter, solver_options const & options, pattern_cache * cache, solver_report & report, solver_workspace & ws){
+    if(options.condense_additional_variables and goal.size() > internal_size and condensed_matrix::is_condensable(mat, internal_size)){
+        condensed_matrix cond(mat, internal_size);
+        x.resize(internal_size, 0.0);
+        cond.solve_CG(goal, x, stopping_criteria(nbr_iter, options), report, ws);
+    }
+    else if(options.reorder_variables){
+        // Refill the reordered matrix and vectors, solve, and put the solution back in the original order
+        pattern_cache local_cache;
+        pattern_cache & used_cache = cache != nullptr ? *cache : local_cache;
+        update_reordering(mat, used_cache);
+        std::vector<std::uint32_t> const & reordering = used_cache.reordering, & elements = used_cache.reordered_elements;
+        csr_matrix & reordered = used_cache.reordered_matrix;
+        std::uint32_t n = goal.size();
+        x.resize(n, 0.0);
+        ws.reordered_goal.resize(n);
+        ws.reordered_solution.resize(n);
+        if(options.deflation_vectors > 0 and ws.solver_indexes.size() == n){
+            // The original indexes follow the variables
+            ws.reordered_indexes.resize(n);
+            for(std::uint32_t i=0; i<n; ++i) ws.reordered_indexes[i] = ws.solver_indexes[reordering[i]];
+            std::swap(ws.solver_indexes, ws.reordered_indexes);
+        }
+        #pragma omp parallel for schedule(static, 1024)
+        for(std::uint32_t i=0; i<n; ++i){
+            std::uint32_t o = reordering[i];
+            reordered.diag[i] = mat.diag[o];
+            for(std::uint32_t j=reordered.row_limits[i]; j<reordered.row_limits[i+1]; ++j){
+                reordered.values[j] = mat.values[elements[j]];
+            }
+            ws.reordered_goal[i] = goal[o];
+            ws.reordered_solution[i] = x[o];
+        }
+        solve_in_format(reordered, ws.reordered_goal, ws.reordered_solution, nbr_iter, options, &used_cache, report, ws);
+        #pragma omp parallel for schedule(static, 1024)
+        for(std::uint32_t i=0; i<n; ++i){
+            x[reordering[i]] = ws.reordered_solution[i];
+        }
+    }
+    else{
+        x.resize(goal.size(), 0.0);
+        solve_in_format(mat, goal, x, nbr_iter, options, cache, report, ws);
+    }
+    x.resize(internal_size);
+}
+
+void linear_system::solve_compressed(std::vector<float_t> const & guess, index_t nbr_iter, solver_options const & options, pattern_cache * cache, solver_report & report, solver_workspace & ws) const{
+    csr_matrix const & mat = ws.matrix;
+    std::vector<float_t> & sol = ws.solution;
+    if(options.eliminate_decoupled_variables){
+        coupled_variables coupled(mat, internal_size(), ws.new_indexes, ws.old_indexes);
+        if(coupled.size() != size()){
+            if(coupled.size() > 0){
+                if(options.deflation_vectors > 0) ws.solver_indexes = coupled.old_indexes;
+                coupled.restrict_matrix(mat, ws.coupled_matrix);
+                coupled.restrict_vector(target_, ws.coupled_goal);
+                coupled.restrict_vector(guess, ws.coupled_solution);
+                solve_compressed_system(ws.coupled_matrix, ws.coupled_goal, ws.coupled_solution, coupled.internal_cnt, nbr_iter, options, cache, report, ws);
+            }
+            coupled.expand_solution(mat, target_, guess, ws.coupled_solution, internal_size(), sol);
+            return;
+        }
+    }
+
+    sol = guess;
+    if(options.deflation_vectors > 0){
+        ws.solver_indexes.resize(size());
+        std::iota(ws.solver_indexes.begin(), ws.solver_indexes.end(), 0);
+    }
+    solve_compressed_system(mat, target_, sol, internal_size(), nbr_iter, options, cache, report, ws);
+}
+
+std::vector<float_t> linear_system::solve_CG(std::vector<float_t> guess, index_t nbr_iter, solver_options const & options, solver_report * report){
+    auto start = std::chrono::steady_clock::now();
+    apply_variable_offsets();
+    solver_workspace workspace;
     doublet_matrix tmp(matrix_, size());
-    csr_matrix mat = tmp.get_compressed_matrix();
+    workspace.matrix = tmp.get_compressed_matrix();
     //ellpack_matrix<16> mat = tmp.get_ellpack_matrix<16>();
-    guess.resize(target_.size(), 0.0);
-    auto ret = mat.solve_CG(target_, guess, nbr_iter, nbr_iter, 0.0);
-    ret.resize(internal_size());
-    return ret;
+    solver_report local_report;
+    solver_report & used_report = report != nullptr ? *report : local_report;
+    solve_compressed(guess, nbr_iter, options, nullptr, used_report, workspace);
+    used_report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return workspace.solution;
+}
+
+std::vector<float_t> linear_system::solve_CG(std::vector<float_t> guess, index_t nbr_iter, symbolic_matrix & structure, solver_options const & options, solver_report * report){
+    auto start = std::chrono::steady_clock::now();
+    apply_variable_offsets();
+    if(not structure.matches(matrix_, size())){
+        structure = symbolic_matrix(matrix_, size());
+    }
+    solver_workspace workspace;
+    structure.get_compressed_matrix(matrix_, workspace.matrix);
+    solver_report local_report;
+    solver_report & used_report = report != nullptr ? *report : local_report;
+    solve_compressed(guess, nbr_iter, options, &structure.cache(), used_report, workspace);
+    used_report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return workspace.solution;
+}
+
+std::vector<float_t> const & linear_system::solve_CG(std::vector<float_t> const & guess, index_t nbr_iter, solver_workspace & workspace, solver_options const & options, solver_report * report){
+    auto start = std::chrono::steady_clock::now();
+    apply_variable_offsets();
+    if(not workspace.structure.matches(matrix_, size())){
+        workspace.structure = symbolic_matrix(matrix_, size());
+    }
+    workspace.structure.get_compressed_matrix(matrix_, workspace.matrix);
+    solver_report local_report;
+    solver_report & used_report = report != nullptr ? *report : local_report;
+    solve_compressed(guess, nbr_iter, options, &workspace.structure.cache(), used_report, workspace);
+    used_report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return workspace.solution;
+}
+
+/*
+ * Two systems with the same sparsity pattern, multiplied together
+ *
+ * The vectors of both systems are interleaved, and the structure of the matrix is traversed once for both products.
+ * When the values are the same too (star and clique models), each value is loaded once and used twice.
+ * Each product is computed in the same order as with a single matrix, so the results are the same.
+ */
+struct paired_csr_matrix{
+    csr_matrix const & A, & B;
+    bool shared_values;
+
+    paired_csr_matrix(csr_matrix const & x_mat, csr_matrix const & y_mat) : A(x_mat), B(y_mat), shared_values(x_mat.values == y_mat.values){
+        assert(A.row_limits == B.row_limits and A.col_indexes == B.col_indexes);
+    }
+    void mul(std::vector<float> const & x, std::vector<float> & res) const;
+};
+
+void paired_csr_matrix::mul(std::vector<float> const & x, std::vector<float> & res) const{
+    std::uint32_t n = A.diag.size();
+    assert(x.size() == 2*n);
+    res.resize(x.size());
+    #pragma omp parallel for schedule(static, 1024)
+    for(std::uint32_t i=0; i<n; ++i){
+        float cur_x = A.diag[i] * x[2*i], cur_y = B.diag[i] * x[2*i+1];
+        if(shared_values){
+            for(std::uint32_t j=A.row_limits[i]; j<A.row_limits[i+1]; ++j){
+                std::uint32_t c = A.col_indexes[j];
+                float v = A.values[j];
+                cur_x += v * x[2*c];
+                cur_y += v * x[2*c+1];
+            }
+        }
+        else{
+            for(std::uint32_t j=A.row_limits[i]; j<A.row_limits[i+1]; ++j){
+                std::uint32_t c = A.col_indexes[j];
+                cur_x += A.values[j] * x[2*c];
+                cur_y += B.values[j] * x[2*c+1];
+            }
+        }
+        res[2*i] = cur_x;
+        res[2*i+1] = cur_y;
+    }
+}
+
+namespace{
+// The dot products of both systems on interleaved vectors, with the same blocks as parallel_dot_prod
+void paired_dot_prod(std::vector<float> const & a, std::vector<float> const & b, point<solver_workspace> & ws, float res[2]){
+    assert(a.size() == b.size());
+    std::uint32_t n = a.size() / 2;
+    std::vector<float> & x_sums = ws.x_.partial_sums, & y_sums = ws.y_.partial_sums;
+    x_sums.resize(vector_block_cnt(n));
+    y_sums.resize(vector_block_cnt(n));
+    #pragma omp parallel for
+    for(std::uint32_t k=0; k<x_sums.size(); ++k){
+        std::uint32_t begin = k * vector_block_size, end = std::min(n, begin + vector_block_size);
+        float sums[2];
+        range_dot_prod_pair(a.data() + 2*begin, b.data() + 2*begin, end - begin, sums);
+        x_sums[k] = sums[0];
+        y_sums[k] = sums[1];
+    }
+    res[0] = sum_blocks(x_sums);
+    res[1] = sum_blocks(y_sums);
+}
+
+// x += alpha p, r -= alpha Ap, z = D^-1 r for both systems, fused as in the single Jacobi update; the systems that stopped are left as they are
+void update_paired_CG_residual(bool const active[2], float const alpha[2], std::vector<float> const & p, std::vector<float> const & mul_res, std::vector<float> const & inverse_diag,
+        std::vector<float> & x, std::vector<float> & r, std::vector<float> & z, point<solver_workspace> & ws, residual_update<float> res[2]){
+    std::uint32_t n = x.size() / 2;
+    solver_workspace * dim_ws[2] = {&ws.x_, &ws.y_};
+    for(solver_workspace * w : dim_ws){
+        w->partial_sums.resize(vector_block_cnt(n));
+        w->partial_sq_norms.resize(vector_block_cnt(n));
+        w->partial_steps.resize(vector_block_cnt(n));
+    }
+    #pragma omp parallel for
+    for(std::uint32_t k=0; k<vector_block_cnt(n); ++k){
+        std::uint32_t begin = k * vector_block_size, end = std::min(n, begin + vector_block_size);
+        float max_step[2] = {0.0f, 0.0f};
+        for(std::uint32_t i=begin; i<end; ++i){
+            for(std::uint32_t d=0; d<2; ++d){
+                if(not active[d]) continue;
+                std::uint32_t ind = 2*i + d;
+                x[ind] = x[ind] + alpha[d] * p[ind];
+                r[ind] = r[ind] - alpha[d] * mul_res[ind];
+                z[ind] = inverse_diag[ind] * r[ind];
+                max_step[d] = std::max(max_step[d], std::abs(alpha[d] * p[ind]));
+            }
+        }
+        float sums[2], sq_norms[2];
+        range_dot_prod_pair(r.data() + 2*begin, z.data() + 2*begin, end - begin, sums);
+        range_dot_prod_pair(r.data() + 2*begin, r.data() + 2*begin, end - begin, sq_norms);
+        for(std::uint32_t d=0; d<2; ++d){
+            dim_ws[d]->partial_sums[k] = sums[d];
+            dim_ws[d]->partial_sq_norms[k] = sq_norms[d];
+            dim_ws[d]->partial_steps[k] = max_step[d];
+        }
+    }
+    for(std::uint32_t d=0; d<2; ++d){
+        std::vector<float> const & steps = dim_ws[d]->partial_steps;
+        res[d].cross_norm = sum_blocks(dim_ws[d]->partial_sums);
+        res[d].residual_sq_norm = sum_blocks(dim_ws[d]->partial_sq_norms);
+        res[d].max_step = steps.empty() ? 0.0f : *std::max_element(steps.begin(), steps.end());
+    }
+}
+
+/*
+ * The conjugate gradients of two systems with the Jacobi preconditioner, run in lockstep on interleaved vectors
+ *
+ * Each system keeps its own coefficients and stopping test, and the iterates are the same as those of separate solves.
+ * A system that stopped isn't updated anymore, but its products are still computed until the other one stops.
+ */
+void solve_paired_CG(paired_csr_matrix const & A, std::vector<float> const & goal, std::vector<float> & x, stopping_criteria const & criteria, point<solver_workspace> & ws, point<solver_report> & reports){
+    std::uint32_t n = A.A.diag.size();
+    assert(goal.size() == 2*n and x.size() == 2*n);
+    solver_workspace & w = ws.x_;
+    std::vector<float> & r = w.residual, & p = w.direction, & z = w.preconditioned, & mul_res = w.product, & inverse_diag = w.inverse_diag;
+    solver_report * dim_reports[2] = {&reports.x_, &reports.y_};
+
+    inverse_diag.resize(2*n);
+    z.resize(2*n);
+    #pragma omp parallel for schedule(static, vector_block_size)
+    for(std::uint32_t i=0; i<n; ++i){
+        inverse_diag[2*i] = 1.0/A.A.diag[i];
+        inverse_diag[2*i+1] = 1.0/A.B.diag[i];
+        assert(std::isfinite(inverse_diag[2*i]) and std::isfinite(inverse_diag[2*i+1]));
+    }
+    A.mul(x, r);
+    #pragma omp parallel for schedule(static, vector_block_size)
+    for(std::uint32_t i=0; i<2*n; ++i){
+        r[i] = goal[i] - r[i];
+        z[i] = inverse_diag[i] * r[i];
+    }
+    p = z;
+
+    float cross_norm[2], goal_norm[2], residual_norm[2];
+    paired_dot_prod(r, z, ws, cross_norm);
+    paired_dot_prod(goal, goal, ws, goal_norm);
+    paired_dot_prod(r, r, ws, residual_norm);
+    bool active[2];
+    for(std::uint32_t d=0; d<2; ++d){
+        assert(std::isfinite(cross_norm[d]));
+        goal_norm[d] = std::sqrt(goal_norm[d]);
+        dim_reports[d]->iterations = 0;
+        dim_reports[d]->residual = std::sqrt(residual_norm[d]);
+        active[d] = true;
+    }
+    float_t const epsilon = std::numeric_limits<float_t>::min();
+
+    for(uint32_t k=0; k < criteria.max_iter; ++k){
+        A.mul(p, mul_res);
+
+        float pr_prod[2], alpha[2];
+        paired_dot_prod(p, mul_res, ws, pr_prod);
+        for(std::uint32_t d=0; d<2; ++d){
+            alpha[d] = cross_norm[d] / pr_prod[d];
+            if(
+                not std::isfinite(cross_norm[d]) or not std::isfinite(alpha[d]) or not std::isfinite(pr_prod[d])
+                or cross_norm[d] <= epsilon or alpha[d] <= epsilon or pr_prod[d] <= epsilon
+                ){
+                active[d] = false;
+            }
+        }
+        if(not active[0] and not active[1]) break;
+
+        // Update the results
+        residual_update<float> update[2];
+        update_paired_CG_residual(active, alpha, p, mul_res, inverse_diag, x, r, z, ws, update);
+
+        // Update the scaled residuals and the search directions
+        float beta[2];
+        for(std::uint32_t d=0; d<2; ++d){
+            beta[d] = 0.0f;
+            if(not active[d]) continue;
+            dim_reports[d]->iterations = k+1;
+            dim_reports[d]->residual = std::sqrt(update[d].residual_sq_norm);
+            if(criteria.is_met(k+1, dim_reports[d]->residual, goal_norm[d], update[d].max_step)){
+                active[d] = false;
+                continue;
+            }
+            beta[d] = update[d].cross_norm / cross_norm[d];
+            cross_norm[d] = update[d].cross_norm;
+        }
+        if(not active[0] and not active[1]) break;
+        #pragma omp parallel for schedule(static, vector_block_size)
+        for(std::uint32_t i=0; i<2*n; ++i){
+            if(active[i % 2]) p[i] = z[i] + beta[i % 2] * p[i];
+        }
+    }
+
+    for(std::uint32_t d=0; d<2; ++d){
+        dim_reports[d]->relative_residual = goal_norm[d] > 0.0f ? dim_reports[d]->residual / goal_norm[d] : 0.0f;
+    }
+}
+
+// Interleave the first n values of the vectors of two systems; the missing values of shorter vectors are null
+void interleave(std::vector<float> const & a, std::vector<float> const & b, std::uint32_t n, std::vector<float> & res){
+    res.resize(2*n);
+    for(std::uint32_t i=0; i<n; ++i){
+        res[2*i] = i < a.size() ? a[i] : 0.0f;
+        res[2*i+1] = i < b.size() ? b[i] : 0.0f;
+    }
 }
 
+void deinterleave(std::vector<float> const & v, std::uint32_t n, std::vector<float> & a, std::vector<float> & b){
+    a.resize(n);
+    b.resize(n);
+    for(std::uint32_t i=0; i<n; ++i){
+        a[i] = v[2*i];
+        b[i] = v[2*i+1];
+    }
+}
+} // End anonymous namespace
+
+bool linear_system::solve_block_CG(point<linear_system> & L, index_t nbr_iter, point<solver_workspace> & ws, solver_options const & options, point<solver_report> & reports){
+    if(options.solver != CGSolver or options.preconditioner != JacobiPreconditioner or options.condense_additional_variables) return false;
+    if(options.mixed_precision or options.refinement_steps > 0 or options.reorder_variables or options.deflation_vectors > 0) return false;
+    if(L.x_.size() != L.y_.size() or L.x_.internal_size() != L.y_.internal_size()) return false;
+
+    auto start = std::chrono::steady_clock::now();
+    L.x_.apply_variable_offsets();
+    L.y_.apply_variable_offsets();
+    index_t n = L.x_.size(), internal_n = L.x_.internal_size();
+    symbolic_matrix & structure = ws.x_.structure;
+    if(not structure.matches(L.x_.matrix_, n)){
+        structure = symbolic_matrix(L.x_.matrix_, n);
+    }
+    if(not structure.matches(L.y_.matrix_, n)) return false;
+    structure.get_compressed_matrix(L.x_.matrix_, ws.x_.matrix);
+    structure.get_compressed_matrix(L.y_.matrix_, ws.y_.matrix);
+
+    stopping_criteria criteria(nbr_iter, options);
+    std::vector<float> const & x_guess = ws.x_.guess, & y_guess = ws.y_.guess;
+    std::vector<float> & x_sol = ws.x_.solution, & y_sol = ws.y_.solution;
+    bool decoupled = false;
+    if(options.eliminate_decoupled_variables){
+        // Same pattern, same coupled variables for both systems
+        coupled_variables coupled(ws.x_.matrix, internal_n, ws.x_.new_indexes, ws.x_.old_indexes);
+        if(coupled.size() != n){
+            decoupled = true;
+            if(coupled.size() > 0){
+                coupled.restrict_matrix(ws.x_.matrix, ws.x_.coupled_matrix);
+                coupled.restrict_matrix(ws.y_.matrix, ws.y_.coupled_matrix);
+                coupled.restrict_vector(L.x_.target_, ws.x_.coupled_goal);
+                coupled.restrict_vector(L.y_.target_, ws.y_.coupled_goal);
+                coupled.restrict_vector(x_guess, ws.x_.coupled_solution);
+                coupled.restrict_vector(y_guess, ws.y_.coupled_solution);
+                interleave(ws.x_.coupled_goal, ws.y_.coupled_goal, coupled.size(), ws.x_.block_goal);
+                interleave(ws.x_.coupled_solution, ws.y_.coupled_solution, coupled.size(), ws.x_.block_solution);
+                solve_paired_CG(paired_csr_matrix(ws.x_.coupled_matrix, ws.y_.coupled_matrix), ws.x_.block_goal, ws.x_.block_solution, criteria, ws, reports);
+                deinterleave(ws.x_.block_solution, coupled.size(), ws.x_.coupled_solution, ws.y_.coupled_solution);
+            }
+            coupled.expand_solution(ws.x_.matrix, L.x_.target_, x_guess, ws.x_.coupled_solution, internal_n, x_sol);
+            coupled.expand_solution(ws.y_.matrix, L.y_.target_, y_guess, ws.y_.coupled_solution, internal_n, y_sol);
+        }
+    }
+    if(not decoupled){
+        interleave(L.x_.target_, L.y_.target_, n, ws.x_.block_goal);
+        interleave(x_guess, y_guess, n, ws.x_.block_solution);
+        solve_paired_CG(paired_csr_matrix(ws.x_.matrix, ws.y_.matrix), ws.x_.block_goal, ws.x_.block_solution, criteria, ws, reports);
+        deinterleave(ws.x_.block_solution, internal_n, x_sol, y_sol);
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    reports.x_.seconds = seconds;
+    reports.y_.seconds = seconds;
+    return true;
 }
+
+template<typename matrix_t>
+product_benchmark time_products(matrix_t const & A, csr_matrix const & mat, MatrixFormat format, index_t product_cnt){
+    std::uint32_t n = mat.diag.size();
+    std::vector<float> x(n, 1.0f), res;
+    A.mul(x, res); // Warm-up
+    auto start = std::chrono::steady_clock::now();
+    for(index_t k=0; k<product_cnt; ++k){
+        A.mul(x, res);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    product_benchmark ret;
+    ret.format = format;
+    ret.seconds = std::chrono::duration<double>(end - start).count() / std::max<index_t>(product_cnt, 1);
+    double flops = 2.0 * (mat.col_indexes.size() + n);
+    double bytes = A.storage_bytes() + 2.0 * n * sizeof(float);
+    ret.gflops = flops / ret.seconds * 1e-9;
+    ret.bandwidth = bytes / ret.seconds * 1e-9;
+    return ret;
 }
 
+product_benchmark linear_system::benchmark_products(MatrixFormat format, index_t product_cnt){
+    apply_variable_offsets();
+    doublet_matrix tmp(matrix_, size());
+    csr_matrix mat = tmp.get_compressed_matrix();
+    format = select_format(mat, format);
+    if(format == DeltaCSRFormat){
+        return time_products(delta_csr_matrix<std::int16_t>(mat), mat, format, product_cnt);
+    }
+    else if(format == SymmetricFormat){
+        return time_products(symmetric_csr_matrix(mat), mat, format, product_cnt);
+    }
+    else if(format == SELLFormat){
+        return time_products(sell_matrix(mat), mat, format, product_cnt);
+    }
+    else{
+        return time_products(mat, mat, format, product_cnt);
+    }
+}
 
+}
+}
 